@@ -0,0 +1,193 @@
+/* Reclamation latency benchmarks.
+
+   This file is part of libsref.
+
+   libsref is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Usage: latency [max-threads] [releases-per-thread]
+ *
+ * Measures the time from the final call to 'sref_release' on an object until
+ * its finalizer runs, as well as the peak number of bytes held by objects
+ * that were released but not yet finalized. Every thread repeatedly enters a
+ * read-side critical section, acquires and releases a number of unrelated
+ * objects to simulate work, and drops the last reference to a fresh object.
+ *
+ * Thread counts and the length of the critical sections are swept here. The
+ * table sizes are fixed at build time; see the 'bench-latency' target in the
+ * Makefile for a sweep over those. The results are written as CSV. */
+
+#include "utils.h"
+
+/* Lengths of the read-side critical sections, in acquire/release pairs. */
+static const unsigned int section_lens[] = { 0, 16, 256 };
+
+/* Number of objects each thread works on within a critical section. */
+#define WORK_NOBJS   64
+
+/* Size of the objects whose reclamation we time. */
+#define PAYLOAD_SIZE   64
+
+typedef struct
+{
+  Object obj;
+  uint64_t released;
+  char payload[PAYLOAD_SIZE];
+} Timed;
+
+static uint64_t *samples;
+static atomic_size_t n_samples;
+static atomic_long pending_bytes;
+static atomic_long peak_bytes;
+
+static void
+timed_fini (void *ptr)
+{
+  Timed *tp = (Timed *)ptr;
+  uint64_t now = xclock_ns ();
+
+  samples[atomic_fetch_add_explicit (&n_samples, 1,
+                                     memory_order_relaxed)] =
+    now - tp->released;
+  atomic_fetch_sub_explicit (&pending_bytes, sizeof (*tp),
+                             memory_order_relaxed);
+  free (tp);
+}
+
+static void
+timed_release (Timed *tp)
+{
+  long prev = atomic_fetch_add_explicit (&pending_bytes, sizeof (*tp),
+                                         memory_order_relaxed);
+  long peak = atomic_load_explicit (&peak_bytes, memory_order_relaxed);
+
+  prev += sizeof (*tp);
+  while (prev > peak &&
+      !atomic_compare_exchange_weak_explicit (&peak_bytes, &peak, prev,
+                                              memory_order_relaxed,
+                                              memory_order_relaxed))
+    ;
+
+  tp->released = xclock_ns ();
+  sref_release (tp);
+}
+
+typedef struct
+{
+  unsigned int section_len;
+  unsigned long n_ops;
+} Run;
+
+static void*
+worker (void *arg)
+{
+  const Run *run = (const Run *)arg;
+  Object *work[WORK_NOBJS];
+  unsigned int seed = (unsigned int)(uintptr_t)&seed;
+
+  for (int i = 0; i < WORK_NOBJS; ++i)
+    work[i] = obj_make (i);
+
+  for (unsigned long i = 0; i < run->n_ops; ++i)
+    {
+      Timed *tp = (Timed *)xmalloc (sizeof (*tp));
+      sref_init (tp, timed_fini);
+
+      sref_read_enter ();
+      for (unsigned int j = 0; j < run->section_len; ++j)
+        {
+          Object *p = work[xrand (&seed) % WORK_NOBJS];
+          sref_acquire (p);
+          sref_release (p);
+        }
+
+      timed_release (tp);
+      sref_read_exit ();
+    }
+
+  for (int i = 0; i < WORK_NOBJS; ++i)
+    sref_release (work[i]);
+
+  return (NULL);
+}
+
+static int
+cmp_u64 (const void *x, const void *y)
+{
+  uint64_t a = *(const uint64_t *)x, b = *(const uint64_t *)y;
+  return ((a > b) - (a < b));
+}
+
+static void
+run_one (unsigned int n_threads, unsigned int section_len,
+         unsigned long n_ops)
+{
+  Run run = { section_len, n_ops };
+  pthread_t *thrs = (pthread_t *)xmalloc (n_threads * sizeof (*thrs));
+  size_t total = (size_t)n_threads * n_ops;
+
+  atomic_store (&n_samples, 0);
+  atomic_store (&pending_bytes, 0);
+  atomic_store (&peak_bytes, 0);
+
+  for (unsigned int i = 0; i < n_threads; ++i)
+    if (pthread_create (&thrs[i], NULL, worker, &run) != 0)
+      abort ();
+
+  for (unsigned int i = 0; i < n_threads; ++i)
+    pthread_join (thrs[i], NULL);
+
+  /* Exiting threads don't flush: They leave their deltas to the registry as
+   * orphans, which wait for the next grace period to be applied. */
+  sref_flush ();
+  if (atomic_load (&n_samples) != total || atomic_load (&n_live) != 0)
+    {
+      fprintf (stderr, "%zu of %zu objects were finalized\n",
+               (size_t)atomic_load (&n_samples), total);
+      exit (EXIT_FAILURE);
+    }
+
+  qsort (samples, total, sizeof (*samples), cmp_u64);
+  printf ("%d,%d,%u,%u,%zu,%llu,%llu,%llu,%ld\n",
+          SREF_NDELTAS, SREF_NMAXOPS, n_threads, section_len, total,
+          (unsigned long long)samples[total / 2],
+          (unsigned long long)samples[total - 1 - total / 100],
+          (unsigned long long)samples[total - 1],
+          (long)atomic_load (&peak_bytes));
+  fflush (stdout);
+  free (thrs);
+}
+
+int main (int argc, char **argv)
+{
+  if (sref_lib_init () < 0)
+    abort ();
+
+  unsigned int max_threads = bench_arg (argc, argv, 1, xcpu_count ());
+  unsigned long n_ops = bench_arg (argc, argv, 2, 100000);
+
+  samples = (uint64_t *)xmalloc (max_threads * n_ops * sizeof (*samples));
+
+  puts ("ndeltas,nmaxops,threads,section,samples,"
+        "p50_ns,p99_ns,max_ns,peak_bytes");
+  for (size_t i = 0; i < ARRAY_SIZE (section_lens); ++i)
+    for (unsigned int n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads)
+      {
+        run_one (n, section_lens[i], n_ops);
+        if (n == max_threads)
+          break;
+      }
+
+  free (samples);
+  return (0);
+}
@@ -0,0 +1,317 @@
+/* Hash map benchmarks.
+
+   This file is part of libsref.
+
+   libsref is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Usage: map [max-threads] [milliseconds-per-run]
+ *
+ * Compares the hash map from the container module with a conventional one
+ * protected by a mutex. Every thread looks up random keys, and replaces the
+ * element for a key in a given percentage of the operations. Thread counts
+ * go up as in the throughput benchmarks, and the results are written to
+ * standard output, as CSV. */
+
+#include "utils.h"
+#include "../container.h"
+#include <string.h>
+
+/* Number of keys in the map. */
+#define MAP_NKEYS   4096
+
+/* Buckets for the mutex-protected map, which doesn't resize. */
+#define MUTEX_NBUCKETS   MAP_NKEYS
+
+/* Percentages of operations that replace an element. */
+static const unsigned int update_pcts[] = { 0, 1, 10 };
+
+/* Operations performed between checks of the stop flag. */
+#define BATCH_OPS   64
+
+typedef struct Elem_
+{
+  SrefMapEntry entry;
+  struct Elem_ *next;
+  unsigned int key;
+  unsigned int value;
+} Elem;
+
+static atomic_long n_elems;
+
+static void
+elem_free (void *ptr)
+{
+  free (ptr);
+  atomic_fetch_sub_explicit (&n_elems, 1, memory_order_relaxed);
+}
+
+static Elem*
+elem_make (unsigned int key, unsigned int value)
+{
+  Elem *ret = (Elem *)xmalloc (sizeof (*ret));
+  sref_init (ret, elem_free);
+  ret->key = key;
+  ret->value = value;
+  atomic_fetch_add_explicit (&n_elems, 1, memory_order_relaxed);
+  return (ret);
+}
+
+static uintptr_t
+key_hash (unsigned int key)
+{
+  return (key * 2654435761u);
+}
+
+/* Keeps the compiler from optimizing reads away. */
+static volatile unsigned int sink;
+
+typedef struct
+{
+  const char *name;
+  void (*setup) (void);
+  unsigned int (*lookup) (unsigned int key);
+  void (*replace) (unsigned int key, unsigned int value);
+  void (*teardown) (void);
+} MapImpl;
+
+static SrefMap *sref_map;
+
+static int
+sref_key_equal (const void *entry, const void *key)
+{
+  return (((const Elem *)entry)->key == *(const unsigned int *)key);
+}
+
+static void
+sref_setup (void)
+{
+  if (!(sref_map = sref_map_new (sref_key_equal)))
+    abort ();
+
+  for (unsigned int i = 0; i < MAP_NKEYS; ++i)
+    sref_map_insert (sref_map, elem_make (i, i), key_hash (i), &i);
+}
+
+static unsigned int
+sref_lookup (unsigned int key)
+{
+  sref_read_enter ();
+  Elem *ep = (Elem *)sref_map_lookup (sref_map, key_hash (key), &key);
+  unsigned int ret = ep ? ep->value : 0;
+  sref_read_exit ();
+  return (ret);
+}
+
+static void
+sref_replace (unsigned int key, unsigned int value)
+{
+  Elem *ep = elem_make (key, value);
+  sref_map_remove (sref_map, key_hash (key), &key);
+  if (sref_map_insert (sref_map, ep, key_hash (key), &key))
+    /* Somebody else put it back first. */
+    sref_fini (ep);
+}
+
+static void
+sref_teardown (void)
+{
+  sref_map_free (sref_map);
+  sref_flush ();
+}
+
+static pthread_mutex_t mutex_lock = PTHREAD_MUTEX_INITIALIZER;
+static Elem *mutex_buckets[MUTEX_NBUCKETS];
+
+static void
+mutex_setup (void)
+{
+  for (unsigned int i = 0; i < MAP_NKEYS; ++i)
+    {
+      Elem *ep = elem_make (i, i);
+      Elem **bp = &mutex_buckets[key_hash (i) % MUTEX_NBUCKETS];
+      ep->next = *bp;
+      *bp = ep;
+    }
+}
+
+static unsigned int
+mutex_lookup (unsigned int key)
+{
+  unsigned int ret = 0;
+
+  pthread_mutex_lock (&mutex_lock);
+  for (Elem *ep = mutex_buckets[key_hash (key) % MUTEX_NBUCKETS];
+      ep; ep = ep->next)
+    if (ep->key == key)
+      {
+        ret = ep->value;
+        break;
+      }
+
+  pthread_mutex_unlock (&mutex_lock);
+  return (ret);
+}
+
+static void
+mutex_replace (unsigned int key, unsigned int value)
+{
+  Elem *nv = elem_make (key, value), *old = NULL;
+
+  pthread_mutex_lock (&mutex_lock);
+  for (Elem **pp = &mutex_buckets[key_hash (key) % MUTEX_NBUCKETS];
+      *pp; pp = &(*pp)->next)
+    if ((*pp)->key == key)
+      {
+        old = *pp;
+        nv->next = old->next;
+        *pp = nv;
+        break;
+      }
+
+  pthread_mutex_unlock (&mutex_lock);
+  if (old)
+    elem_free (old);
+}
+
+static void
+mutex_teardown (void)
+{
+  for (unsigned int i = 0; i < MUTEX_NBUCKETS; ++i)
+    for (Elem *ep = mutex_buckets[i], *next; ep; ep = next)
+      {
+        next = ep->next;
+        elem_free (ep);
+      }
+
+  memset (mutex_buckets, 0, sizeof (mutex_buckets));
+}
+
+static const MapImpl map_impls[] =
+{
+  {
+    "sref",
+    sref_setup,
+    sref_lookup,
+    sref_replace,
+    sref_teardown
+  },
+  {
+    "mutex",
+    mutex_setup,
+    mutex_lookup,
+    mutex_replace,
+    mutex_teardown
+  }
+};
+
+typedef struct
+{
+  const MapImpl *impl;
+  unsigned int update_pct;
+  atomic_int running;
+  atomic_int stop;
+  atomic_ulong ops;
+} Run;
+
+static void*
+worker (void *arg)
+{
+  Run *run = (Run *)arg;
+  unsigned int seed = (unsigned int)(uintptr_t)&seed;
+  unsigned long ops = 0;
+  unsigned int sum = 0;
+
+  while (!atomic_load_explicit (&run->running, memory_order_acquire))
+    ;
+
+  while (!atomic_load_explicit (&run->stop, memory_order_relaxed))
+    {
+      for (int i = 0; i < BATCH_OPS; ++i)
+        {
+          unsigned int key = xrand (&seed) % MAP_NKEYS;
+          if (xrand (&seed) % 100 < run->update_pct)
+            run->impl->replace (key, key + ops);
+          else
+            sum += run->impl->lookup (key);
+        }
+
+      ops += BATCH_OPS;
+    }
+
+  sink = sum;
+  atomic_fetch_add (&run->ops, ops);
+  return (NULL);
+}
+
+static void
+run_one (const MapImpl *impl, unsigned int update_pct,
+         unsigned int n_threads, unsigned long mlsec)
+{
+  Run run = { .impl = impl, .update_pct = update_pct };
+  pthread_t *thrs = (pthread_t *)xmalloc (n_threads * sizeof (*thrs));
+
+  impl->setup ();
+  for (unsigned int i = 0; i < n_threads; ++i)
+    if (pthread_create (&thrs[i], NULL, worker, &run) != 0)
+      abort ();
+
+  uint64_t start = xclock_ns ();
+  atomic_store (&run.running, 1);
+
+  struct timespec ts = { .tv_sec = mlsec / 1000,
+                         .tv_nsec = (mlsec % 1000) * 1000000 };
+  nanosleep (&ts, NULL);
+  atomic_store (&run.stop, 1);
+
+  for (unsigned int i = 0; i < n_threads; ++i)
+    pthread_join (thrs[i], NULL);
+
+  double secs = (xclock_ns () - start) / 1e9;
+  unsigned long ops = atomic_load (&run.ops);
+
+  printf ("%s,%u,%u,%lu,%.6f,%.3f\n", impl->name, update_pct,
+          n_threads, ops, secs, ops / secs / 1e6);
+  fflush (stdout);
+
+  impl->teardown ();
+  if (atomic_load (&n_elems) != 0)
+    {
+      fprintf (stderr, "%s: leaked %ld elements\n",
+               impl->name, (long)atomic_load (&n_elems));
+      exit (EXIT_FAILURE);
+    }
+
+  free (thrs);
+}
+
+int main (int argc, char **argv)
+{
+  if (sref_lib_init () < 0)
+    abort ();
+
+  unsigned int max_threads = bench_arg (argc, argv, 1, xcpu_count ());
+  unsigned long mlsec = bench_arg (argc, argv, 2, 200);
+
+  puts ("impl,update_pct,threads,ops,seconds,mops");
+  for (size_t i = 0; i < ARRAY_SIZE (update_pcts); ++i)
+    for (size_t j = 0; j < ARRAY_SIZE (map_impls); ++j)
+      for (unsigned int n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads)
+        {
+          run_one (&map_impls[j], update_pcts[i], n, mlsec);
+          if (n == max_threads)
+            break;
+        }
+
+  return (0);
+}
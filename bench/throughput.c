@@ -0,0 +1,234 @@
+/* Throughput benchmarks.
+
+   This file is part of libsref.
+
+   libsref is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Usage: throughput [max-threads] [milliseconds-per-run]
+ *
+ * Every scenario is run for each implementation, at 1, 2, 4... threads, up
+ * to the maximum (by default, the number of online CPU's). The results are
+ * written to standard output, as CSV. */
+
+#include "utils.h"
+
+/* Number of slots for the mixed scenario. */
+#define MIXED_NSLOTS   16
+
+/* Number of objects for the cold scenario. */
+#define COLD_NOBJS   (1u << 16)
+
+/* Operations performed between checks of the stop flag. */
+#define BATCH_OPS   64
+
+static Object *_Atomic slots[COLD_NOBJS];
+static unsigned int n_slots;
+
+/* Keeps the compiler from optimizing reads away. */
+static volatile unsigned int sink;
+
+static void
+setup (unsigned int n)
+{
+  for (unsigned int i = 0; i < n; ++i)
+    atomic_init (&slots[i], obj_make (i));
+
+  n_slots = n;
+}
+
+static void
+teardown (const BenchImpl *impl)
+{
+  for (unsigned int i = 0; i < n_slots; ++i)
+    impl->release (atomic_load_explicit (&slots[i], memory_order_relaxed));
+
+  impl->quiesce ();
+  if (atomic_load (&n_live) != 0)
+    {
+      fprintf (stderr, "%s: leaked %ld objects\n",
+               impl->name, (long)atomic_load (&n_live));
+      exit (EXIT_FAILURE);
+    }
+}
+
+/* Acquire and release a single object shared by every thread. */
+static unsigned long
+run_hot (const BenchImpl *impl, unsigned int *seed)
+{
+  (void)seed;
+  Object *p = atomic_load_explicit (&slots[0], memory_order_relaxed);
+
+  for (int i = 0; i < BATCH_OPS; ++i)
+    {
+      impl->enter ();
+      impl->acquire (p);
+      impl->release (p);
+      impl->exit ();
+    }
+
+  return (BATCH_OPS);
+}
+
+/* Acquire and release objects at random from a large set. */
+static unsigned long
+run_cold (const BenchImpl *impl, unsigned int *seed)
+{
+  for (int i = 0; i < BATCH_OPS; ++i)
+    {
+      Object *p = atomic_load_explicit (&slots[xrand (seed) % COLD_NOBJS],
+                                        memory_order_relaxed);
+      impl->enter ();
+      impl->acquire (p);
+      impl->release (p);
+      impl->exit ();
+    }
+
+  return (BATCH_OPS);
+}
+
+/* Read a shared slot without keeping a reference. */
+static unsigned long
+run_read (const BenchImpl *impl, unsigned int *seed)
+{
+  unsigned int sum = 0;
+  for (int i = 0; i < BATCH_OPS; ++i)
+    {
+      impl->enter ();
+      Object *p = impl->load (&slots[xrand (seed) % MIXED_NSLOTS]);
+      sum += p->value;
+      impl->unload (p);
+      impl->exit ();
+    }
+
+  sink = sum;
+  return (BATCH_OPS);
+}
+
+/* Mostly reads, with 1 in 16 operations replacing an object, in the manner
+ * of the example at examples/array.c */
+static unsigned long
+run_mixed (const BenchImpl *impl, unsigned int *seed)
+{
+  for (int i = 0; i < BATCH_OPS; ++i)
+    {
+      Object *_Atomic *slot = &slots[xrand (seed) % MIXED_NSLOTS];
+      impl->enter ();
+      Object *p = impl->load (slot);
+
+      if (i % 16 == 0)
+        impl->swap (slot, obj_make (p->value + 1));
+
+      impl->unload (p);
+      impl->exit ();
+    }
+
+  return (BATCH_OPS);
+}
+
+typedef struct
+{
+  const char *name;
+  unsigned long (*fn) (const BenchImpl *, unsigned int *);
+  unsigned int n_objs;
+} Scenario;
+
+static const Scenario scenarios[] =
+{
+  { "hot", run_hot, 1 },
+  { "cold", run_cold, COLD_NOBJS },
+  { "read", run_read, MIXED_NSLOTS },
+  { "mixed", run_mixed, MIXED_NSLOTS }
+};
+
+typedef struct
+{
+  const Scenario *scenario;
+  const BenchImpl *impl;
+  atomic_int running;
+  atomic_int stop;
+  atomic_ulong ops;
+} Run;
+
+static void*
+worker (void *arg)
+{
+  Run *run = (Run *)arg;
+  unsigned int seed = (unsigned int)(uintptr_t)&seed;
+  unsigned long ops = 0;
+
+  while (!atomic_load_explicit (&run->running, memory_order_acquire))
+    ;
+
+  while (!atomic_load_explicit (&run->stop, memory_order_relaxed))
+    ops += run->scenario->fn (run->impl, &seed);
+
+  atomic_fetch_add (&run->ops, ops);
+  return (NULL);
+}
+
+static void
+run_one (const Scenario *sc, const BenchImpl *impl,
+         unsigned int n_threads, unsigned long mlsec)
+{
+  Run run = { .scenario = sc, .impl = impl };
+  pthread_t *thrs = (pthread_t *)xmalloc (n_threads * sizeof (*thrs));
+
+  impl->setup ();
+  setup (sc->n_objs);
+  for (unsigned int i = 0; i < n_threads; ++i)
+    if (pthread_create (&thrs[i], NULL, worker, &run) != 0)
+      abort ();
+
+  uint64_t start = xclock_ns ();
+  atomic_store (&run.running, 1);
+
+  struct timespec ts = { .tv_sec = mlsec / 1000,
+                         .tv_nsec = (mlsec % 1000) * 1000000 };
+  nanosleep (&ts, NULL);
+  atomic_store (&run.stop, 1);
+
+  for (unsigned int i = 0; i < n_threads; ++i)
+    pthread_join (thrs[i], NULL);
+
+  double secs = (xclock_ns () - start) / 1e9;
+  unsigned long ops = atomic_load (&run.ops);
+
+  printf ("%s,%s,%u,%lu,%.6f,%.3f\n", sc->name, impl->name,
+          n_threads, ops, secs, ops / secs / 1e6);
+  fflush (stdout);
+
+  teardown (impl);
+  free (thrs);
+}
+
+int main (int argc, char **argv)
+{
+  if (sref_lib_init () < 0)
+    abort ();
+
+  unsigned int max_threads = bench_arg (argc, argv, 1, xcpu_count ());
+  unsigned long mlsec = bench_arg (argc, argv, 2, 200);
+
+  puts ("scenario,impl,threads,ops,seconds,mops");
+  for (size_t i = 0; i < ARRAY_SIZE (scenarios); ++i)
+    for (size_t j = 0; j < ARRAY_SIZE (bench_impls); ++j)
+      for (unsigned int n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads)
+        {
+          run_one (&scenarios[i], &bench_impls[j], n, mlsec);
+          if (n == max_threads)
+            break;
+        }
+
+  return (0);
+}
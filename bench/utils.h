@@ -0,0 +1,276 @@
+/* General utilities for benchmarks.
+
+   This file is part of libsref.
+
+   libsref is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef BENCH_UTILS_H_
+#define BENCH_UTILS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "../sref.h"
+#include "../compat.h"
+
+#define ARRAY_SIZE(x)   (sizeof (x) / sizeof (x[0]))
+
+static void*
+xmalloc (size_t size)
+{
+  void *ret = malloc (size);
+  if (!ret)
+    abort ();
+
+  return (ret);
+}
+
+/* Very basic (and crappy) PRNG. */
+static unsigned int
+xrand (unsigned int *prev)
+{
+  unsigned int x = *prev * 1103515245 + 12345;
+  *prev = x;
+  return (x >> 16);
+}
+
+/* Objects carry both an Sref and an atomic reference count, so that the same
+ * scenario can be run against libsref and a conventional implementation. */
+typedef struct
+{
+  Sref base;
+  atomic_long refcnt;
+  unsigned int value;
+} Object;
+
+static atomic_long n_live;
+
+static void
+obj_free (void *ptr)
+{
+  free (ptr);
+  atomic_fetch_sub_explicit (&n_live, 1, memory_order_relaxed);
+}
+
+static inline Object*
+obj_make (unsigned int value)
+{
+  Object *ret = (Object *)xmalloc (sizeof (*ret));
+  sref_init (ret, obj_free);
+  atomic_init (&ret->refcnt, 1);
+  ret->value = value;
+  atomic_fetch_add_explicit (&n_live, 1, memory_order_relaxed);
+  return (ret);
+}
+
+/* A reference counting implementation. 'setup' is called before each run.
+ * Every operation is done between calls to 'enter' and 'exit', which delimit
+ * a read-side critical section. Within it, 'load' reads a shared slot and
+ * returns a pointer that is safe to use until the matching 'unload', while
+ * 'swap' publishes a new object in a slot and releases the previous one. */
+typedef struct
+{
+  const char *name;
+  void (*setup) (void);
+  void (*enter) (void);
+  void (*exit) (void);
+  void (*acquire) (Object *);
+  void (*release) (Object *);
+  Object* (*load) (Object *_Atomic *);
+  void (*unload) (Object *);
+  void (*swap) (Object *_Atomic *, Object *);
+  void (*quiesce) (void);
+} BenchImpl;
+
+static void
+sref_impl_setup (void)
+{
+  if (sref_lib_init_ex (0) < 0)
+    abort ();
+}
+
+/* On a single node, set SREF_NUMA_NODES to simulate a topology. */
+static void
+sref_impl_setup_numa (void)
+{
+  if (sref_lib_init_ex (SREF_LIB_NUMA) < 0)
+    abort ();
+}
+
+static void
+sref_impl_enter (void)
+{
+  sref_read_enter ();
+}
+
+static void
+sref_impl_exit (void)
+{
+  sref_read_exit ();
+}
+
+static void
+sref_impl_acquire (Object *p)
+{
+  sref_acquire (p);
+}
+
+static void
+sref_impl_release (Object *p)
+{
+  sref_release (p);
+}
+
+static Object*
+sref_impl_load (Object *_Atomic *slot)
+{
+  return (atomic_load_explicit (slot, memory_order_acquire));
+}
+
+static void
+sref_impl_unload (Object *p)
+{
+  (void)p;
+}
+
+static void
+sref_impl_swap (Object *_Atomic *slot, Object *nv)
+{
+  sref_release (atomic_exchange_explicit (slot, nv, memory_order_acq_rel));
+}
+
+static void
+sref_impl_quiesce (void)
+{
+  sref_flush ();
+}
+
+static void
+atomic_impl_acquire (Object *p)
+{
+  atomic_fetch_add_explicit (&p->refcnt, 1, memory_order_relaxed);
+}
+
+static void
+atomic_impl_release (Object *p)
+{
+  if (atomic_fetch_sub_explicit (&p->refcnt, 1, memory_order_acq_rel) == 1)
+    obj_free (p);
+}
+
+/* Loading a shared pointer and bumping its reference count must be atomic
+ * with respect to the last release, so we use a pool of spinlocks keyed by
+ * the slot's address, as common atomic shared pointer implementations do. */
+
+#define BENCH_NLOCKS   64
+
+static atomic_flag atomic_impl_locks[BENCH_NLOCKS];
+
+static atomic_flag*
+atomic_impl_lock (void *slot)
+{
+  uintptr_t key = (uintptr_t)slot;
+  atomic_flag *ret = &atomic_impl_locks[(key ^ (key >> 6)) % BENCH_NLOCKS];
+
+  while (atomic_flag_test_and_set_explicit (ret, memory_order_acquire))
+    ;
+
+  return (ret);
+}
+
+static Object*
+atomic_impl_load (Object *_Atomic *slot)
+{
+  atomic_flag *lock = atomic_impl_lock (slot);
+  Object *ret = atomic_load_explicit (slot, memory_order_relaxed);
+  atomic_impl_acquire (ret);
+  atomic_flag_clear_explicit (lock, memory_order_release);
+  return (ret);
+}
+
+static void
+atomic_impl_swap (Object *_Atomic *slot, Object *nv)
+{
+  atomic_flag *lock = atomic_impl_lock (slot);
+  Object *old = atomic_exchange_explicit (slot, nv, memory_order_relaxed);
+  atomic_flag_clear_explicit (lock, memory_order_release);
+  atomic_impl_release (old);
+}
+
+static void
+atomic_impl_nop (void)
+{
+}
+
+static const BenchImpl bench_impls[] =
+{
+  {
+    "sref",
+    sref_impl_setup,
+    sref_impl_enter,
+    sref_impl_exit,
+    sref_impl_acquire,
+    sref_impl_release,
+    sref_impl_load,
+    sref_impl_unload,
+    sref_impl_swap,
+    sref_impl_quiesce
+  },
+  {
+    "sref-numa",
+    sref_impl_setup_numa,
+    sref_impl_enter,
+    sref_impl_exit,
+    sref_impl_acquire,
+    sref_impl_release,
+    sref_impl_load,
+    sref_impl_unload,
+    sref_impl_swap,
+    sref_impl_quiesce
+  },
+  {
+    "atomic",
+    atomic_impl_nop,
+    atomic_impl_nop,
+    atomic_impl_nop,
+    atomic_impl_acquire,
+    atomic_impl_release,
+    atomic_impl_load,
+    atomic_impl_release,
+    atomic_impl_swap,
+    atomic_impl_nop
+  }
+};
+
+/* Parse a positive integer from the command line, or use a default. */
+static unsigned long
+bench_arg (int argc, char **argv, int idx, unsigned long dfl)
+{
+  if (idx >= argc)
+    return (dfl);
+
+  char *end;
+  unsigned long ret = strtoul (argv[idx], &end, 10);
+  if (*end || !ret)
+    {
+      fprintf (stderr, "invalid argument: %s\n", argv[idx]);
+      exit (EXIT_FAILURE);
+    }
+
+  return (ret);
+}
+
+#endif
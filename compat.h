@@ -29,9 +29,26 @@
 #define xatomic_store_rel(ptr, val)   \
   atomic_store_explicit ((ptr), (val), memory_order_release)
 
+#define xatomic_swap(ptr, val)   \
+  atomic_exchange_explicit ((ptr), (val), memory_order_acq_rel)
+
+#define xatomic_swap_ptr   xatomic_swap
+
+#define xatomic_load_rlx_int    xatomic_load_rlx
+#define xatomic_store_rel_int   xatomic_store_rel
+
+static inline uintptr_t
+xatomic_cas (uintptr_t *ptr, uintptr_t exp, uintptr_t nval)
+{
+  atomic_compare_exchange_strong_explicit (ptr, &exp, nval,
+                                           memory_order_acq_rel,
+                                           memory_order_acquire);
+  return (exp);
+}
+
 #define xatomic_mfence_acq()   atomic_signal_fence (memory_order_acquire)
 
-#define xatomic_mfence_full()   atomic_signal_fence (memory_order_seq_cst)
+#define xatomic_mfence_full()   atomic_thread_fence (memory_order_seq_cst)
 
 #define xthread_sleep(mlsec)   \
   thrd_sleep (&(struct timespec) { .tv_sec = 0,   \
@@ -48,6 +65,43 @@ xmutex_init (xmutex_t *mtx)
 #define xmutex_unlock    mtx_unlock
 #define xmutex_destroy   mtx_destroy
 
+typedef cnd_t xcond_t;
+
+static inline int
+xcond_init (xcond_t *cv)
+{
+  return (cnd_init (cv) == thrd_success ? 0 : -1);
+}
+
+#define xcond_wait        cnd_wait
+#define xcond_signal      cnd_signal
+#define xcond_broadcast   cnd_broadcast
+#define xcond_destroy     cnd_destroy
+
+/* Wait on CV for at most NS nanoseconds. */
+static inline void
+xcond_timedwait (xcond_t *cv, xmutex_t *mtx, uint64_t ns)
+{
+  struct timespec ts;
+  timespec_get (&ts, TIME_UTC);
+  ns += (uint64_t)ts.tv_nsec;
+  ts.tv_sec += (time_t)(ns / 1000000000);
+  ts.tv_nsec = (long)(ns % 1000000000);
+  cnd_timedwait (cv, mtx, &ts);
+}
+
+typedef thrd_t xthread_t;
+
+#define XTHREAD_RET   int
+
+static inline int
+xthread_create (xthread_t *thr, int (*fn) (void *), void *arg)
+{
+  return (thrd_create (thr, fn, arg) == thrd_success ? 0 : -1);
+}
+
+#define xthread_join(thr)   thrd_join ((thr), NULL)
+
 typedef tss_t xkey_t;
 
 #define xkey_set   tss_set
@@ -66,6 +120,7 @@ xkey_create (xkey_t *key, void (*fini) (void *))
     (defined (__GNUC__) || defined (__clang__))
 
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 
 #define xatomic_load_rlx(ptr)   __atomic_load_n ((ptr), __ATOMIC_RELAXED)
@@ -75,6 +130,22 @@ xkey_create (xkey_t *key, void (*fini) (void *))
 #define xatomic_store_rel(ptr, val)   \
    __atomic_store_n ((ptr), (val), __ATOMIC_RELEASE)
 
+#define xatomic_swap(ptr, val)   \
+   __atomic_exchange_n ((ptr), (val), __ATOMIC_ACQ_REL)
+
+#define xatomic_swap_ptr   xatomic_swap
+
+#define xatomic_load_rlx_int    xatomic_load_rlx
+#define xatomic_store_rel_int   xatomic_store_rel
+
+static inline uintptr_t
+xatomic_cas (uintptr_t *ptr, uintptr_t exp, uintptr_t nval)
+{
+  __atomic_compare_exchange_n (ptr, &exp, nval, 0,
+                               __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  return (exp);
+}
+
 #define xatomic_mfence_acq()   __atomic_thread_fence (__ATOMIC_ACQUIRE)
 
 #define xatomic_mfence_full()   __atomic_thread_fence (__ATOMIC_SEQ_CST)
@@ -89,6 +160,34 @@ typedef pthread_mutex_t xmutex_t;
 #define xmutex_unlock    pthread_mutex_unlock
 #define xmutex_destroy   pthread_mutex_destroy
 
+typedef pthread_cond_t xcond_t;
+
+#define xcond_init(cv)   pthread_cond_init ((cv), NULL)
+
+#define xcond_wait        pthread_cond_wait
+#define xcond_signal      pthread_cond_signal
+#define xcond_broadcast   pthread_cond_broadcast
+#define xcond_destroy     pthread_cond_destroy
+
+/* Wait on CV for at most NS nanoseconds. */
+static inline void
+xcond_timedwait (xcond_t *cv, xmutex_t *mtx, uint64_t ns)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  ns += (uint64_t)ts.tv_nsec;
+  ts.tv_sec += (time_t)(ns / 1000000000);
+  ts.tv_nsec = (long)(ns % 1000000000);
+  pthread_cond_timedwait (cv, mtx, &ts);
+}
+
+typedef pthread_t xthread_t;
+
+#define XTHREAD_RET   void*
+
+#define xthread_create(thr, fn, arg)   pthread_create ((thr), NULL, (fn), (arg))
+#define xthread_join(thr)              pthread_join ((thr), NULL)
+
 typedef pthread_key_t xkey_t;
 
 #define xkey_create   pthread_key_create
@@ -125,6 +224,35 @@ xatomic_store_rel (uintptr_t *ptr, uintptr_t val)
   MemoryBarrier ();
 }
 
+/* The above work on pointer-sized words. These are for the 32-bit ones
+ * that futexes wait on. */
+static inline unsigned int
+xatomic_load_rlx_int (unsigned int *ptr)
+{
+  return (*(volatile unsigned int *)ptr);
+}
+
+static inline void
+xatomic_store_rel_int (unsigned int *ptr, unsigned int val)
+{
+  *ptr = val;
+  _WriteBarrier ();
+  MemoryBarrier ();
+}
+
+#define xatomic_swap(ptr, val)   \
+  InterlockedExchange ((volatile LONG *)(ptr), (LONG)(val))
+
+/* Unlike the above, this one works on the whole of a pointer-sized word. */
+#define xatomic_swap_ptr(ptr, val)   \
+  ((uintptr_t)InterlockedExchangePointer ((PVOID volatile *)(ptr),   \
+                                          (PVOID)(val)))
+
+#define xatomic_cas(ptr, exp, nval)   \
+  ((uintptr_t)InterlockedCompareExchangePointer ((PVOID volatile *)(ptr),   \
+                                                 (PVOID)(nval),   \
+                                                 (PVOID)(exp)))
+
 #define xatomic_mfence_acq()   \
   do   \
     {   \
@@ -146,6 +274,35 @@ typedef SRWLOCK xmutex_t;
 
 #define xmutex_destroy(mtx)   ((void)(mtx))
 
+typedef CONDITION_VARIABLE xcond_t;
+
+#define xcond_init(cv)   (InitializeConditionVariable (cv), 0)
+
+#define xcond_wait(cv, mtx)   \
+  SleepConditionVariableSRW ((cv), (mtx), INFINITE, 0)
+
+#define xcond_timedwait(cv, mtx, ns)   \
+  SleepConditionVariableSRW ((cv), (mtx), (DWORD)((ns) / 1000000), 0)
+
+#define xcond_signal      WakeConditionVariable
+#define xcond_broadcast   WakeAllConditionVariable
+#define xcond_destroy(cv)   ((void)(cv))
+
+typedef HANDLE xthread_t;
+
+#define XTHREAD_RET   DWORD WINAPI
+
+#define xthread_create(thr, fn, arg)   \
+  ((*(thr) = CreateThread (NULL, 0, (fn), (arg), 0, NULL)) ? 0 : -1)
+
+#define xthread_join(thr)   \
+  do   \
+    {   \
+      WaitForSingleObject ((thr), INFINITE);   \
+      CloseHandle (thr);   \
+    }   \
+  while (0)
+
 typedef int xkey_t;
 
 extern int __tlregdtor (void (*fn) (void));
@@ -172,3 +329,398 @@ xkey_set (xkey_t *key, void (*fn) (void))
 #  error "unsupported platform"
 
 #endif
+
+#ifdef _MSC_VER
+
+static inline unsigned int
+xcpu_count (void)
+{
+  SYSTEM_INFO info;
+  GetSystemInfo (&info);
+  return ((unsigned int)info.dwNumberOfProcessors);
+}
+
+static inline uint64_t
+xclock_ns (void)
+{
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&now);
+  return ((uint64_t)(now.QuadPart * (1e9 / freq.QuadPart)));
+}
+
+#else
+
+#include <time.h>
+#include <unistd.h>
+
+static inline unsigned int
+xcpu_count (void)
+{
+  long ret = sysconf (_SC_NPROCESSORS_ONLN);
+  return (ret > 0 ? (unsigned int)ret : 1);
+}
+
+static inline uint64_t
+xclock_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec);
+}
+
+#endif
+
+/* Fences between readers and the grace period side. By default, both sides
+ * issue full fences. With membarrier(2), the grace period side forces every
+ * running thread to issue one instead, so readers only need to keep the
+ * compiler from reordering their accesses. */
+
+#ifdef SREF_USE_MEMBARRIER
+
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+
+static int xmembarrier_cmd;
+
+static inline int
+xmembarrier_init (void)
+{
+  long mask = syscall (SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+  if (mask < 0)
+    return (-1);
+  else if ((mask & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+           syscall (SYS_membarrier,
+                    MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0)
+    xmembarrier_cmd = MEMBARRIER_CMD_PRIVATE_EXPEDITED;
+  else if (mask & MEMBARRIER_CMD_GLOBAL)
+    /* Much slower, but still correct. */
+    xmembarrier_cmd = MEMBARRIER_CMD_GLOBAL;
+  else
+    return (-1);
+
+  return (0);
+}
+
+#define xatomic_mfence_rd()   __atomic_signal_fence (__ATOMIC_SEQ_CST)
+#define xatomic_mfence_gp()   \
+  ((void)syscall (SYS_membarrier, xmembarrier_cmd, 0, 0))
+
+#else
+
+#define xmembarrier_init()    0
+#define xatomic_mfence_rd()   xatomic_mfence_full ()
+#define xatomic_mfence_gp()   xatomic_mfence_full ()
+
+#endif
+
+/* NUMA topology. 'xnuma_addr_node' returns XNUMA_UNKNOWN if the node that
+ * backs an address can't be determined, and 'xnuma_bind' restricts the
+ * calling thread to the CPU's of a node. */
+
+#define XNUMA_UNKNOWN   (~0u)
+
+#if defined (_MSC_VER)
+
+static inline unsigned int
+xnuma_count (void)
+{
+  ULONG ret;
+  return (GetNumaHighestNodeNumber (&ret) ? (unsigned int)ret + 1 : 1);
+}
+
+static inline unsigned int
+xnuma_node (void)
+{
+  PROCESSOR_NUMBER pn;
+  USHORT ret;
+
+  GetCurrentProcessorNumberEx (&pn);
+  return (GetNumaProcessorNodeEx (&pn, &ret) ? ret : 0);
+}
+
+static inline unsigned int
+xnuma_addr_node (const void *addr)
+{
+  (void)addr;
+  return (XNUMA_UNKNOWN);
+}
+
+static inline int
+xnuma_bind (unsigned int node)
+{
+  GROUP_AFFINITY aff;
+  if (!GetNumaNodeProcessorMaskEx ((USHORT)node, &aff))
+    return (-1);
+
+  return (SetThreadGroupAffinity (GetCurrentThread (), &aff, NULL) ? 0 : -1);
+}
+
+#elif defined (__linux__)
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+
+/* Read a CPU or node list (e.g: "0-3,8-11") from sysfs. Calls FN for every
+ * member of the list, and returns -1 if the file can't be read. */
+static inline int
+xnuma_read_list (const char *path, void (*fn) (unsigned long, void *),
+                 void *arg)
+{
+  char buf[1024];
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return (-1);
+
+  ssize_t len = read (fd, buf, sizeof (buf) - 1);
+  close (fd);
+  if (len <= 0)
+    return (-1);
+
+  buf[len] = 0;
+  for (char *p = buf; *p >= '0' && *p <= '9'; )
+    {
+      unsigned long lo = strtoul (p, &p, 10), hi = lo;
+      if (*p == '-')
+        hi = strtoul (p + 1, &p, 10);
+
+      for (; lo <= hi; ++lo)
+        fn (lo, arg);
+
+      if (*p == ',')
+        ++p;
+    }
+
+  return (0);
+}
+
+static inline void
+xnuma_count_fn (unsigned long node, void *arg)
+{
+  unsigned int *outp = (unsigned int *)arg;
+  if (node >= *outp)
+    *outp = (unsigned int)node + 1;
+}
+
+static inline unsigned int
+xnuma_count (void)
+{
+  unsigned int ret = 0;
+  if (xnuma_read_list ("/sys/devices/system/node/online",
+                       xnuma_count_fn, &ret) < 0 || !ret)
+    ret = 1;
+
+  return (ret);
+}
+
+static inline unsigned int
+xnuma_node (void)
+{
+  unsigned int cpu, node;
+  return (syscall (SYS_getcpu, &cpu, &node, NULL) == 0 ? node : 0);
+}
+
+static inline unsigned int
+xnuma_addr_node (const void *addr)
+{
+  /* MPOL_F_NODE | MPOL_F_ADDR: Return the node that backs ADDR. */
+  int node;
+  if (syscall (SYS_get_mempolicy, &node, NULL, 0, addr, 3ul) < 0)
+    return (XNUMA_UNKNOWN);
+
+  return ((unsigned int)node);
+}
+
+#define XNUMA_MAXCPUS   1024
+
+static inline void
+xnuma_bind_fn (unsigned long cpu, void *arg)
+{
+  unsigned long *mask = (unsigned long *)arg;
+  const unsigned long nbits = sizeof (*mask) * 8;
+
+  if (cpu < XNUMA_MAXCPUS)
+    mask[cpu / nbits] |= 1ul << (cpu % nbits);
+}
+
+static inline int
+xnuma_bind (unsigned int node)
+{
+  unsigned long mask[XNUMA_MAXCPUS / (sizeof (unsigned long) * 8)] = { 0 };
+  char path[64];
+
+  snprintf (path, sizeof (path),
+            "/sys/devices/system/node/node%u/cpulist", node);
+  if (xnuma_read_list (path, xnuma_bind_fn, mask) < 0)
+    return (-1);
+
+  return (syscall (SYS_sched_setaffinity, 0, sizeof (mask), mask) < 0 ?
+          -1 : 0);
+}
+
+#else
+
+#define xnuma_count()           1u
+#define xnuma_node()            0u
+#define xnuma_addr_node(addr)   ((void)(addr), XNUMA_UNKNOWN)
+#define xnuma_bind(node)        ((void)(node), -1)
+
+#endif
+
+#if defined (__GNUC__) || defined (__clang__)
+#  define xprefetch(ptr)   __builtin_prefetch ((ptr), 1)
+#elif defined (_MSC_VER)
+#  define xprefetch(ptr)   PreFetchCacheLine (PF_TEMPORAL_LEVEL_1, (ptr))
+#else
+#  define xprefetch(ptr)   ((void)(ptr))
+#endif
+
+/* Static tracepoints. With SystemTap's <sys/sdt.h>, each one compiles to a
+ * single 'nop' plus a note section that tools like perf and bpftrace use to
+ * find and enable them at runtime. Otherwise, they are removed entirely. */
+
+#ifdef SREF_USE_SDT
+
+#include <sys/sdt.h>
+
+#define xtrace1(name, a)      DTRACE_PROBE1 (sref, name, a)
+#define xtrace2(name, a, b)   DTRACE_PROBE2 (sref, name, a, b)
+
+#else
+
+#define xtrace1(name, a)      ((void)0)
+#define xtrace2(name, a, b)   ((void)0)
+
+#endif
+
+/* Compare a group of XGROUP_SIZE consecutive pointers against PTR at once.
+ * Returns a mask with bit I set if KEYS[I] is equal to PTR. */
+
+#include <stdint.h>
+
+#define XGROUP_SIZE   4
+#define XGROUP_MASK   ((1u << XGROUP_SIZE) - 1)
+
+#if UINTPTR_MAX > 0xffffffffu && defined (__AVX2__)
+
+#include <immintrin.h>
+
+static inline unsigned int
+xgroup_match (void *const *keys, const void *ptr)
+{
+  __m256i eq = _mm256_cmpeq_epi64 (_mm256_loadu_si256 ((const __m256i *)keys),
+                                   _mm256_set1_epi64x ((intptr_t)ptr));
+  return ((unsigned int)_mm256_movemask_pd (_mm256_castsi256_pd (eq)));
+}
+
+#elif UINTPTR_MAX > 0xffffffffu && (defined (__SSE2__) || defined (_M_X64))
+
+#include <emmintrin.h>
+
+/* SSE2 lacks 64-bit compares, so we compare both halves of each pointer,
+ * and require that both of them be equal. */
+static inline unsigned int
+xgroup_match2 (void *const *keys, __m128i val)
+{
+  __m128i eq = _mm_cmpeq_epi32 (_mm_loadu_si128 ((const __m128i *)keys), val);
+  eq = _mm_and_si128 (eq, _mm_shuffle_epi32 (eq, _MM_SHUFFLE (2, 3, 0, 1)));
+  return ((unsigned int)_mm_movemask_pd (_mm_castsi128_pd (eq)));
+}
+
+static inline unsigned int
+xgroup_match (void *const *keys, const void *ptr)
+{
+  __m128i val = _mm_set1_epi64x ((intptr_t)ptr);
+  return (xgroup_match2 (keys, val) | (xgroup_match2 (keys + 2, val) << 2));
+}
+
+#elif UINTPTR_MAX <= 0xffffffffu &&   \
+    (defined (__SSE2__) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2))
+
+#include <emmintrin.h>
+
+static inline unsigned int
+xgroup_match (void *const *keys, const void *ptr)
+{
+  __m128i eq = _mm_cmpeq_epi32 (_mm_loadu_si128 ((const __m128i *)keys),
+                                _mm_set1_epi32 ((intptr_t)ptr));
+  return ((unsigned int)_mm_movemask_ps (_mm_castsi128_ps (eq)));
+}
+
+#elif UINTPTR_MAX > 0xffffffffu && defined (__aarch64__) &&   \
+    defined (__ARM_NEON)
+
+#include <arm_neon.h>
+
+static inline unsigned int
+xgroup_match (void *const *keys, const void *ptr)
+{
+  uint64x2_t val = vdupq_n_u64 ((uintptr_t)ptr);
+  uint64x2_t lo = vceqq_u64 (vld1q_u64 ((const uint64_t *)keys), val);
+  uint64x2_t hi = vceqq_u64 (vld1q_u64 ((const uint64_t *)keys + 2), val);
+
+  return ((unsigned int)((vgetq_lane_u64 (lo, 0) & 1) |
+                         (vgetq_lane_u64 (lo, 1) & 2) |
+                         (vgetq_lane_u64 (hi, 0) & 4) |
+                         (vgetq_lane_u64 (hi, 1) & 8)));
+}
+
+#else
+
+static inline unsigned int
+xgroup_match (void *const *keys, const void *ptr)
+{
+  unsigned int ret = 0;
+  for (unsigned int i = 0; i < XGROUP_SIZE; ++i)
+    ret |= (unsigned int)(keys[i] == ptr) << i;
+
+  return (ret);
+}
+
+#endif
+
+/* Index of the first match in a mask returned by 'xgroup_match'. */
+#define xgroup_first(bits)   \
+  (((bits) & 1) ? 0 : (((bits) & 2) ? 1 : (((bits) & 4) ? 2 : 3)))
+
+/* Wait for up to MLSEC milliseconds, as long as *PTR is equal to VAL. Spurious
+ * wakeups are allowed, so callers must recheck their condition. */
+
+#if defined (__linux__)
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+static inline void
+xfutex_wait (unsigned int *ptr, unsigned int val, unsigned int mlsec)
+{
+  struct timespec ts = { .tv_sec = mlsec / 1000,
+                         .tv_nsec = (mlsec % 1000) * 1000000 };
+  syscall (SYS_futex, ptr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+static inline void
+xfutex_wake (unsigned int *ptr)
+{
+  syscall (SYS_futex, ptr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+#elif defined (_MSC_VER)
+
+static inline void
+xfutex_wait (unsigned int *ptr, unsigned int val, unsigned int mlsec)
+{
+  WaitOnAddress (ptr, &val, sizeof (val), mlsec);
+}
+
+#define xfutex_wake   WakeByAddressAll
+
+#else
+
+#define xfutex_wait(ptr, val, mlsec)   xthread_sleep (mlsec)
+#define xfutex_wake(ptr)               ((void)(ptr))
+
+#endif
@@ -0,0 +1,332 @@
+/* Definitions for the containers built on the sref API.
+
+   This file is part of libsref.
+
+   libsref is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* The library itself always provides the out-of-line versions. */
+#undef SREF_INLINE
+
+#include "container.h"
+#include "compat.h"
+#include <stdlib.h>
+
+/*
+ * Every container serializes its writers with a mutex, while readers only
+ * follow links. Links are published with release stores and read with
+ * acquire loads, so that a reader sees an element fully initialized, and
+ * unlinked elements keep pointing to their successors, so that a reader
+ * that is standing on one still gets to the end. Everything that is
+ * unlinked is released, and thus freed no sooner than after a grace period,
+ * including the bucket arrays, which are reference counted as well.
+ */
+
+#define link_load(ptr)   ((void *)xatomic_load_acq ((uintptr_t *)(ptr)))
+
+#define link_store(ptr, val)   \
+  xatomic_store_rel ((uintptr_t *)(ptr), (uintptr_t)(val))
+
+/*
+ * Hash map.
+ *
+ * Elements are chained in buckets, and the number of buckets doubles when
+ * there are more than 2 elements per bucket on average, and halves when
+ * there are less than 1 per 8. Resizing moves every element to a chain of
+ * a new array, so a lookup that races with it may miss; those are detected
+ * with a sequence counter that is odd while a resize is in progress, and
+ * retried. Since the elements are moved with release stores after making
+ * the counter odd, a lookup that was thrown off by a move is bound to see
+ * the counter changed.
+ */
+
+#define MAP_MIN_BUCKETS   16
+
+typedef struct
+{
+  Sref base;
+  uintptr_t mask;
+  SrefMapEntry *buckets[];
+} SrefMapTable;
+
+struct SrefMap_
+{
+  Sref base;
+  SrefMapTable *table;
+  uintptr_t seq;
+  uintptr_t n_entries;
+  SrefMapEqual equal;
+  xmutex_t lock;
+};
+
+static SrefMapTable*
+map_table_new (uintptr_t n_buckets)
+{
+  SrefMapTable *ret = (SrefMapTable *)calloc (1, sizeof (*ret) +
+                                              n_buckets *
+                                              sizeof (ret->buckets[0]));
+  if (!ret)
+    return (ret);
+
+  sref_init (ret, free);
+  ret->mask = n_buckets - 1;
+  return (ret);
+}
+
+static void
+map_fini (void *ptr)
+{
+  SrefMap *map = (SrefMap *)ptr;
+  xmutex_destroy (&map->lock);
+  free (map);
+}
+
+SrefMap* sref_map_new (SrefMapEqual equal)
+{
+  SrefMap *ret = (SrefMap *)malloc (sizeof (*ret));
+  if (!ret)
+    return (ret);
+  else if (!(ret->table = map_table_new (MAP_MIN_BUCKETS)))
+    {
+      free (ret);
+      return (NULL);
+    }
+  else if (xmutex_init (&ret->lock) < 0)
+    {
+      free (ret->table);
+      free (ret);
+      return (NULL);
+    }
+
+  sref_init (ret, map_fini);
+  ret->seq = 0;
+  ret->n_entries = 0;
+  ret->equal = equal;
+  return (ret);
+}
+
+void sref_map_free (SrefMap *map)
+{
+  SrefMapTable *tp = map->table;
+  for (uintptr_t i = 0; i <= tp->mask; ++i)
+    for (SrefMapEntry *ep = tp->buckets[i], *next; ep; ep = next)
+      {
+        next = ep->next;
+        sref_release (ep);
+      }
+
+  sref_release (tp);
+  sref_release (map);
+}
+
+void* sref_map_lookup (SrefMap *map, uintptr_t hash, const void *key)
+{
+  while (1)
+    {
+      uintptr_t seq = xatomic_load_acq (&map->seq);
+      SrefMapTable *tp = (SrefMapTable *)link_load (&map->table);
+
+      for (SrefMapEntry *ep = (SrefMapEntry *)
+             link_load (&tp->buckets[hash & tp->mask]); ep;
+           ep = (SrefMapEntry *)link_load (&ep->next))
+        if (ep->hash == hash && map->equal (ep, key))
+          return (ep);
+
+      if (!(seq & 1) && xatomic_load_rlx (&map->seq) == seq)
+        return (NULL);
+    }
+}
+
+/* Move every element to a table with N_BUCKETS. If it can't be allocated,
+ * the current one is kept, and lookups are merely slower. */
+static void
+map_resize (SrefMap *map, uintptr_t n_buckets)
+{
+  SrefMapTable *tp = map->table, *np = map_table_new (n_buckets);
+  if (!np)
+    return;
+
+  xatomic_store_rel (&map->seq, map->seq + 1);
+  for (uintptr_t i = 0; i <= tp->mask; ++i)
+    for (SrefMapEntry *ep = tp->buckets[i], *next; ep; ep = next)
+      {
+        SrefMapEntry **bp = &np->buckets[ep->hash & np->mask];
+        next = ep->next;
+        link_store (&ep->next, *bp);
+        *bp = ep;
+      }
+
+  link_store (&map->table, np);
+  xatomic_store_rel (&map->seq, map->seq + 1);
+  sref_release (tp);
+}
+
+int sref_map_insert (SrefMap *map, void *entry,
+                     uintptr_t hash, const void *key)
+{
+  SrefMapEntry *ep = (SrefMapEntry *)entry;
+
+  xmutex_lock (&map->lock);
+  SrefMapTable *tp = map->table;
+  SrefMapEntry **bp = &tp->buckets[hash & tp->mask];
+
+  for (SrefMapEntry *p = *bp; p; p = p->next)
+    if (p->hash == hash && map->equal (p, key))
+      {
+        xmutex_unlock (&map->lock);
+        return (1);
+      }
+
+  ep->hash = hash;
+  ep->next = *bp;
+  link_store (bp, ep);
+
+  uintptr_t n = map->n_entries + 1;
+  xatomic_store_rel (&map->n_entries, n);
+  if (n > (tp->mask + 1) * 2)
+    map_resize (map, (tp->mask + 1) * 2);
+
+  xmutex_unlock (&map->lock);
+  return (0);
+}
+
+int sref_map_remove (SrefMap *map, uintptr_t hash, const void *key)
+{
+  xmutex_lock (&map->lock);
+  SrefMapTable *tp = map->table;
+  SrefMapEntry *ep, **pp = &tp->buckets[hash & tp->mask];
+
+  for ( ; (ep = *pp) != NULL; pp = &ep->next)
+    if (ep->hash == hash && map->equal (ep, key))
+      break;
+
+  if (!ep)
+    {
+      xmutex_unlock (&map->lock);
+      return (-1);
+    }
+
+  /* Readers that are on the element keep following its link. */
+  link_store (pp, ep->next);
+
+  uintptr_t n = map->n_entries - 1;
+  xatomic_store_rel (&map->n_entries, n);
+  if (tp->mask + 1 > MAP_MIN_BUCKETS && n < (tp->mask + 1) / 8)
+    map_resize (map, (tp->mask + 1) / 2);
+
+  xmutex_unlock (&map->lock);
+  sref_release (ep);
+  return (0);
+}
+
+size_t sref_map_size (const SrefMap *map)
+{
+  return ((size_t)xatomic_load_rlx ((uintptr_t *)&map->n_entries));
+}
+
+/*
+ * Singly linked list.
+ */
+
+struct SrefList_
+{
+  Sref base;
+  SrefListEntry *head;
+  xmutex_t lock;
+};
+
+static void
+list_fini (void *ptr)
+{
+  SrefList *list = (SrefList *)ptr;
+  xmutex_destroy (&list->lock);
+  free (list);
+}
+
+SrefList* sref_list_new (void)
+{
+  SrefList *ret = (SrefList *)malloc (sizeof (*ret));
+  if (!ret)
+    return (ret);
+  else if (xmutex_init (&ret->lock) < 0)
+    {
+      free (ret);
+      return (NULL);
+    }
+
+  sref_init (ret, list_fini);
+  ret->head = NULL;
+  return (ret);
+}
+
+void sref_list_free (SrefList *list)
+{
+  for (SrefListEntry *ep = list->head, *next; ep; ep = next)
+    {
+      next = ep->next;
+      sref_release (ep);
+    }
+
+  sref_release (list);
+}
+
+void sref_list_push (SrefList *list, void *entry)
+{
+  SrefListEntry *ep = (SrefListEntry *)entry;
+
+  xmutex_lock (&list->lock);
+  ep->next = list->head;
+  link_store (&list->head, ep);
+  xmutex_unlock (&list->lock);
+}
+
+void* sref_list_pop (SrefList *list)
+{
+  xmutex_lock (&list->lock);
+  SrefListEntry *ret = list->head;
+  if (ret)
+    link_store (&list->head, ret->next);
+
+  xmutex_unlock (&list->lock);
+  return (ret);
+}
+
+int sref_list_remove (SrefList *list, void *entry)
+{
+  SrefListEntry *ep, **pp = &list->head;
+
+  xmutex_lock (&list->lock);
+  for ( ; (ep = *pp) != NULL; pp = &ep->next)
+    if (ep == entry)
+      {
+        link_store (pp, ep->next);
+        break;
+      }
+
+  xmutex_unlock (&list->lock);
+  if (!ep)
+    return (-1);
+
+  sref_release (ep);
+  return (0);
+}
+
+void* sref_list_first (const SrefList *list)
+{
+  return (link_load (&list->head));
+}
+
+void* sref_list_next (const void *entry)
+{
+  return (link_load (&((const SrefListEntry *)entry)->next));
+}
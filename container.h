@@ -0,0 +1,95 @@
+/* Declarations for the containers built on the sref API.
+
+   This file is part of libsref.
+
+   libsref is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef SREF_CONTAINER_H_
+#define SREF_CONTAINER_H_   1
+
+#include "sref.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Elements are intrusive: Their type must start with one of the entry
+ * types below, which in turn start with an Sref, so that they can also be
+ * acquired and released directly. A container owns a reference to each of
+ * its elements, and releases it when they are removed. */
+
+typedef struct SrefMapEntry_
+{
+  Sref base;
+  struct SrefMapEntry_ *next;
+  uintptr_t hash;
+} SrefMapEntry;
+
+typedef struct SrefListEntry_
+{
+  Sref base;
+  struct SrefListEntry_ *next;
+} SrefListEntry;
+
+typedef struct SrefMap_ SrefMap;
+typedef struct SrefList_ SrefList;
+
+/* Compare the key of an element with KEY. Returns non-zero if equal. */
+typedef int (*SrefMapEqual) (const void *entry, const void *key);
+
+/* Create a hash map, whose keys are compared with EQUAL. */
+extern SrefMap* sref_map_new (SrefMapEqual equal);
+
+/* Release every element in a map, and the map itself. */
+extern void sref_map_free (SrefMap *map);
+
+/* Look up the element for KEY, whose hash code is HASH. Must be called
+ * within a read-side critical section. */
+extern void* sref_map_lookup (SrefMap *map, uintptr_t hash, const void *key);
+
+/* Insert ENTRY under KEY, handing the caller's reference to the map.
+ * Returns 1 if an element with that key is already present. */
+extern int sref_map_insert (SrefMap *map, void *entry,
+                            uintptr_t hash, const void *key);
+
+/* Remove the element for KEY, and release it. */
+extern int sref_map_remove (SrefMap *map, uintptr_t hash, const void *key);
+
+/* Get the number of elements in a map. */
+extern size_t sref_map_size (const SrefMap *map);
+
+/* Create a singly linked list. */
+extern SrefList* sref_list_new (void);
+
+/* Release every element in a list, and the list itself. */
+extern void sref_list_free (SrefList *list);
+
+/* Insert ENTRY at the front, handing the caller's reference to the list. */
+extern void sref_list_push (SrefList *list, void *entry);
+
+/* Remove the first element, and hand the list's reference to the caller. */
+extern void* sref_list_pop (SrefList *list);
+
+/* Remove ENTRY from a list, and release it. */
+extern int sref_list_remove (SrefList *list, void *entry);
+
+/* Iterate over a list. Must be called within a read-side critical section. */
+extern void* sref_list_first (const SrefList *list);
+extern void* sref_list_next (const void *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -58,7 +58,7 @@ reader (void *arg)
     {
       Object **base = (i & 1) ? array_1 : array_2;
       sref_read_enter ();
-      Object *p = base[xrand (&rand_val) % N_ELEM];
+      Object *p = sref_deref (&base[xrand (&rand_val) % N_ELEM]);
 
       if (i % 16 == 0)
         printf ("got value: %d\n", p->value);
@@ -76,11 +76,11 @@ swapper (void *arg)
   for (int i = 0; i < N_LOOPS; ++i)
     {
       sref_read_enter ();
-      Object *p = sref_acquire (array_1[xrand (&rand_val) % N_ELEM]);
-      Object *old = atomic_exchange_explicit (array_2 +
-        (xrand (&rand_val) % N_ELEM), p, memory_order_acq_rel);
+      Object *p = sref_deref (&array_1[xrand (&rand_val) % N_ELEM]);
 
-      sref_release (old);
+      /* The slot takes over the reference we acquire, and the one it had
+       * to the previous object is released. */
+      sref_swap (&array_2[xrand (&rand_val) % N_ELEM], sref_acquire (p));
       sref_read_exit ();
     }
 
@@ -97,14 +97,11 @@ mutator (void *arg)
       unsigned int index = xrand (&rand_val) % N_ELEM;
 
       sref_read_enter ();
-      Object *p = base[index];
+      Object *p = sref_deref (&base[index]);
       Object *nv = make_obj (p->value * 2);
 
-      if (!atomic_compare_exchange_strong_explicit (&base[index],
-          &p, nv, memory_order_acq_rel, memory_order_relaxed))
+      if (sref_cas (&base[index], p, nv) < 0)
         sref_fini (nv);
-      else
-        sref_release (p);
 
       sref_read_exit ();
     }
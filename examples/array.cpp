@@ -0,0 +1,135 @@
+/* The same scenario as array.c, written with the C++ interface. Build with:
+ *
+ *   c++ -std=c++11 -I. examples/array.cpp -L. -lsref -pthread */
+
+#include "sref.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+struct Object
+{
+  Sref base;
+  int value;
+
+  explicit Object (int val) : base (), value (val)
+    {
+      ++n_existing;
+    }
+
+  ~Object ()
+    {
+      --n_existing;
+    }
+
+  static std::atomic<unsigned long> n_existing;
+};
+
+std::atomic<unsigned long> Object::n_existing;
+
+/* Very basic (and crappy) PRNG. */
+static unsigned int
+xrand (unsigned int *prev)
+{
+  unsigned int x = *prev * 1103515245 + 12345;
+  *prev = x;
+  return (x >> 16);
+}
+
+#define N_ELEM   16
+
+/* Each slot owns a reference to the object in it. */
+static std::atomic<Object *> array_1[N_ELEM];
+static std::atomic<Object *> array_2[N_ELEM];
+
+#define N_LOOPS   100
+
+static void
+reader (unsigned int rand_val)
+{
+  for (int i = 0; i < N_LOOPS; ++i)
+    {
+      std::atomic<Object *> *base = (i & 1) ? array_1 : array_2;
+      sref::read_guard guard;
+
+      /* Only looking, so no reference is taken at all. */
+      sref::borrowed<Object> p (base[xrand (&rand_val) % N_ELEM].load ());
+
+      if (i % 16 == 0)
+        std::printf ("got value: %d\n", p->value);
+    }
+}
+
+static void
+swapper (unsigned int rand_val)
+{
+  for (int i = 0; i < N_LOOPS; ++i)
+    {
+      sref::read_guard guard;
+      sref::ptr<Object> p (array_1[xrand (&rand_val) % N_ELEM].load ());
+
+      /* The slot takes over our reference, and we take over the one that
+       * the slot had to the previous object, which is released on scope
+       * exit. Neither of these touches the tables of deltas. */
+      sref::ptr<Object> old (array_2[xrand (&rand_val) % N_ELEM].exchange
+                               (p.detach ()), sref::adopt);
+    }
+}
+
+static void
+mutator (unsigned int rand_val)
+{
+  for (int i = 0; i < N_LOOPS; ++i)
+    {
+      std::atomic<Object *> *base = (i & 1) ? array_2 : array_1;
+      unsigned int index = xrand (&rand_val) % N_ELEM;
+
+      sref::read_guard guard;
+      Object *p = base[index].load ();
+      sref::ptr<Object> nv = sref::make<Object> (p->value * 2);
+
+      if (base[index].compare_exchange_strong (p, nv.get ()))
+        { /* Swap the references along with the pointers. */
+          nv.detach ();
+          sref::ptr<Object> old (p, sref::adopt);
+        }
+    }
+}
+
+#define N_THREADS   5
+
+int main ()
+{
+  if (sref_lib_init () < 0)
+    std::abort ();
+
+  unsigned int seed = std::time (0);
+  for (int i = 0; i < N_ELEM; ++i)
+    {
+      array_1[i] = sref::make<Object> (xrand (&seed)).detach ();
+      array_2[i] = sref::make<Object> (xrand (&seed)).detach ();
+    }
+
+  std::vector<std::thread> thrs;
+  for (int i = 0; i < N_THREADS * 3; ++i)
+    thrs.emplace_back ((i % 3) == 0 ? reader :
+                       ((i % 3) == 1 ? swapper : mutator), seed);
+
+  std::puts ("joining threads");
+  for (auto& thr : thrs)
+    thr.join ();
+
+  for (int i = 0; i < N_ELEM; ++i)
+    {
+      sref_release (array_1[i].load ());
+      sref_release (array_2[i].load ());
+    }
+
+  assert (sref_flush () == 0);
+  assert (Object::n_existing == 0);
+  return (0);
+}
@@ -15,18 +15,16 @@
    You should have received a copy of the GNU General Public License
    along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
 
+/* The library itself always provides the out-of-line versions. */
+#undef SREF_INLINE
+
 #include "sref.h"
 #include "compat.h"
 #include "version.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <stddef.h>
-
-typedef struct
-{
-  void *ptr;
-  intptr_t delta;
-} SrefDelta;
+#include <string.h>
 
 #ifndef SREF_NDELTAS
 #  define SREF_NDELTAS   128
@@ -34,64 +32,400 @@ typedef struct
 
 #if (SREF_NDELTAS & (SREF_NDELTAS - 1)) != 0
 #  error "number of deltas must be a power of 2"
+#elif SREF_NDELTAS < XGROUP_SIZE
+#  error "number of deltas is too small"
 #endif
 
 #ifndef SREF_NMAXOPS
 #  define SREF_NMAXOPS   1024
 #endif
 
-/* Mapping of pointers to deltas. */
+/* Percentage of the slots in a table that triggers a flush. */
+#ifndef SREF_LOAD_FACTOR
+#  define SREF_LOAD_FACTOR   75
+#endif
+
+/* Bounds for runtime configuration. Tables must never fill up entirely, or
+ * probing wouldn't terminate. */
+#define CONFIG_MIN_LOAD       10
+#define CONFIG_MAX_LOAD       90
+#define CONFIG_MAX_CAPACITY   (1u << 24)
+
+/* Nanoseconds of grace period that each operation in a batch may account
+ * for when the flush trigger is adaptive. Grace periods that cost more than
+ * this per batched operation make threads batch more, and vice versa. */
+#ifndef SREF_ADAPT_NS_PER_OP
+#  define SREF_ADAPT_NS_PER_OP   50
+#endif
+
+/* Settings for threads that register from now on. They start out as the
+ * build time defaults, and may be changed with 'sref_lib_config' or from
+ * the environment. */
+typedef struct
+{
+  unsigned int capacity;
+  unsigned int load;
+  uintptr_t max_ops;
+  unsigned int helpers;
+  uintptr_t adapt_min;
+  uintptr_t adapt_max;
+  unsigned int finalizers;
+} SrefConfig;
+
+/* The flush trigger is only adaptive when 'adapt_max' is set. */
+static SrefConfig lib_config =
+{
+  SREF_NDELTAS,
+  SREF_LOAD_FACTOR,
+  SREF_NMAXOPS,
+  0,
+  0,
+  0,
+  1
+};
+
+/*
+ * Statistics.
+ *
+ * Every counter is thread-local, and is credited to the thread that did the
+ * work. Reading the statistics for the whole process aggregates the counters
+ * of every registered thread, plus those of the threads that already exited.
+ */
+
+#ifdef SREF_STATS
+
+static xthread_local SrefStats local_stats;
+
+#  define SREF_STAT_ADD(field, n)   (local_stats.field += (n))
+#  define SREF_STAT_CLOCK(var)      uint64_t var = xclock_ns ()
+#  define SREF_STAT_ELAPSED(field, var)   \
+     SREF_STAT_ADD (field, xclock_ns () - (var))
+
+static void
+sref_stat_probe (uintptr_t nprobe)
+{
+  unsigned int bucket = 0;
+  while ((nprobe >>= 1) && bucket < SREF_STATS_NPROBES - 1)
+    ++bucket;
+
+  ++local_stats.probes[bucket];
+}
+
+static void
+sref_stats_add (SrefStats *dst, const SrefStats *src)
+{
+  const uint64_t *sp = (const uint64_t *)src;
+  uint64_t *dp = (uint64_t *)dst;
+
+  for (size_t i = 0; i < sizeof (*src) / sizeof (*sp); ++i)
+    dp[i] += xatomic_load_rlx (&sp[i]);
+}
+
+#else
+#  define SREF_STAT_ADD(field, n)         ((void)0)
+#  define SREF_STAT_CLOCK(var)            ((void)0)
+#  define SREF_STAT_ELAPSED(field, var)   ((void)0)
+#  define sref_stat_probe(nprobe)         ((void)0)
+#endif
+
+#define SREF_STAT_INC(field)   SREF_STAT_ADD (field, 1)
+
+/* Mapping of pointers to deltas.
+ *
+ * Pointers and deltas are kept in separate arrays, so that lookups can
+ * compare a whole group of pointers at once (see 'xgroup_match'), and so
+ * that scans can skip empty groups without touching the deltas. Probing is
+ * quadratic over groups of slots, rather than over individual slots.
+ *
+ * Tables start out using their inline storage, unless they were configured
+ * with a bigger capacity, and are only moved to the heap if they need to
+ * grow while the owning thread is unable to flush. Note that the flush
+ * trigger ('limit') is always relative to the configured capacity, so a
+ * grown table doesn't delay reclamation any further than a regular one. */
 
 typedef struct
 {
-  SrefDelta deltas[SREF_NDELTAS];
+  void **keys;
+  intptr_t *vals;
   unsigned int n_used;
+  unsigned int n_max;
+  unsigned int load;
+  unsigned int limit;
+  void *inline_keys[SREF_NDELTAS];
+  intptr_t inline_vals[SREF_NDELTAS];
 } SrefTable;
 
+static void
+sref_table_set_load (SrefTable *tp, unsigned int capacity, unsigned int load)
+{
+  unsigned int limit = (capacity * load + 99) / 100;
+
+  /* Small tables at a high load would otherwise leave no free slots for
+   * the deltas that are added until a pending flush gets to run. */
+  if (limit + 2 > capacity)
+    limit = capacity > 2 ? capacity - 2 : 1;
+
+  tp->load = load;
+  tp->limit = limit;
+}
+
+static void
+sref_table_init (SrefTable *tp)
+{
+  tp->keys = tp->inline_keys;
+  tp->vals = tp->inline_vals;
+  tp->n_used = 0;
+  tp->n_max = SREF_NDELTAS;
+  sref_table_set_load (tp, SREF_NDELTAS, SREF_LOAD_FACTOR);
+}
+
+/* Set up an empty table with CAPACITY slots. Returns -1 if it doesn't fit
+ * in the inline storage and can't be allocated. */
+static int
+sref_table_setup (SrefTable *tp, unsigned int capacity, unsigned int load)
+{
+  if (capacity > SREF_NDELTAS)
+    {
+      void **keys = (void **)calloc (capacity,
+                                     sizeof (*keys) + sizeof (intptr_t));
+      if (!keys)
+        return (-1);
+
+      tp->keys = keys;
+      tp->vals = (intptr_t *)(keys + capacity);
+    }
+
+  tp->n_max = capacity;
+  sref_table_set_load (tp, capacity, load);
+  return (0);
+}
+
+static void
+sref_table_fini (SrefTable *tp)
+{
+  if (tp->keys != tp->inline_keys)
+    free (tp->keys);
+  else if (tp->n_used)
+    { /* Deltas added by finalizers after the last flush are lost. */
+      memset (tp->inline_keys, 0, sizeof (tp->inline_keys));
+      memset (tp->inline_vals, 0, sizeof (tp->inline_vals));
+    }
+
+  sref_table_init (tp);
+}
+
+/* Returns the index of the first slot in the group for PTR. */
+static inline uintptr_t
+sref_hash (const SrefTable *tp, void *ptr)
+{
+  return (((uintptr_t)ptr >> 3) & (tp->n_max - 1) & ~(XGROUP_SIZE - 1));
+}
+
 static int
 sref_add (SrefTable *tp, void *ptr, intptr_t add, uintptr_t *outp)
 {
-  uintptr_t idx = ((uintptr_t)ptr >> 3) % SREF_NDELTAS;
+  uintptr_t mask = tp->n_max - 1;
+  uintptr_t idx = sref_hash (tp, ptr);
   uintptr_t nprobe = 1;
-  assert (tp->n_used < SREF_NDELTAS);
+  assert (tp->n_used < tp->n_max);
+
+  if (tp->keys[idx] == ptr)
+    { /* Repeated operations on the same object usually end up here. */
+      tp->vals[idx] += add;
+      sref_stat_probe (nprobe);
+      return (0);
+    }
 
   for ( ; ; ++nprobe)
     {
-      SrefDelta *dp = tp->deltas + idx;
-      if (!dp->ptr)
+      unsigned int bits = xgroup_match (tp->keys + idx, ptr);
+      if (bits)
         {
-          dp->ptr = ptr;
-          dp->delta = add;
-          *outp = idx;
-          return (++tp->n_used * 100 >= SREF_NDELTAS * 75);
+          tp->vals[idx + xgroup_first (bits)] += add;
+          sref_stat_probe (nprobe);
+          return (0);
         }
-      else if (dp->ptr == ptr)
+
+      bits = xgroup_match (tp->keys + idx, NULL);
+      if (bits)
         {
-          dp->delta += add;
-          return (0);
+          idx += xgroup_first (bits);
+          tp->keys[idx] = ptr;
+          tp->vals[idx] = add;
+          *outp = idx;
+          sref_stat_probe (nprobe);
+          return (++tp->n_used >= tp->limit);
         }
 
-      idx = (idx + nprobe) % SREF_NDELTAS;
+      idx = (idx + nprobe * XGROUP_SIZE) & mask;
+    }
+}
+
+static inline int
+sref_table_fits_p (const SrefTable *tp, size_t n)
+{
+  return ((tp->n_used + n) * 100 < (size_t)tp->n_max * tp->load);
+}
+
+static inline int
+sref_table_full_p (const SrefTable *tp)
+{
+  return (!sref_table_fits_p (tp, 0));
+}
+
+/* Iterate over the N used slots in KEYS, a group at a time, stopping once
+ * every one of them has been visited. The body may clear the current slot. */
+#define sref_keys_foreach(keys, n, i)   \
+  for (unsigned int i##_base = 0, i##_left = (n);   \
+       i##_left; i##_base += XGROUP_SIZE)   \
+    for (unsigned int i##_bits = xgroup_match ((keys) + i##_base, NULL) ^   \
+           XGROUP_MASK, i = i##_base; i##_bits; i##_bits >>= 1, ++i)   \
+      if ((i##_bits & 1) && (--i##_left, 1))
+
+static int
+sref_table_grow (SrefTable *tp)
+{
+  unsigned int n_max = tp->n_max * 2;
+  if (n_max < tp->n_max)
+    return (-1);
+
+  void **keys = (void **)calloc (n_max, sizeof (*keys) + sizeof (intptr_t));
+  if (!keys)
+    return (-1);
+
+  void **prev_keys = tp->keys;
+  intptr_t *prev_vals = tp->vals;
+  unsigned int n_used = tp->n_used;
+  uintptr_t idx;
+
+  tp->keys = keys;
+  tp->vals = (intptr_t *)(keys + n_max);
+  tp->n_max = n_max;
+  tp->n_used = 0;
+
+  sref_keys_foreach (prev_keys, n_used, i)
+    {
+      sref_add (tp, prev_keys[i], prev_vals[i], &idx);
+      prev_keys[i] = NULL;
+      prev_vals[i] = 0;
     }
+
+  if (prev_keys != tp->inline_keys)
+    free (prev_keys);
+
+  return (0);
 }
 
 static void
 sref_merge (SrefTable *dst, SrefTable *src)
 {
   uintptr_t idx;
-  for (unsigned int i = 0, j = 0; j < src->n_used; ++i)
+  sref_keys_foreach (src->keys, src->n_used, i)
     {
-      SrefDelta *dp = src->deltas + i;
-      if (!dp->ptr)
-        continue;
-
-      int rv = sref_add (dst, dp->ptr, dp->delta, &idx);
-      dp->ptr = NULL;
+      int rv = sref_add (dst, src->keys[i], src->vals[i], &idx);
+      src->keys[i] = NULL;
+      src->vals[i] = 0;
       --src->n_used;
 
       if (rv)
-        break;
+        return;
+    }
+}
+
+/* Deferred callbacks, stored in fixed-size batches. The first batch is kept
+ * inline so that the common case doesn't need any allocation. */
+
+#ifndef SREF_NCALLS
+#  define SREF_NCALLS   32
+#endif
+
+typedef struct
+{
+  void *ptr;
+  void (*cb) (void *);
+} SrefCall;
+
+typedef struct SrefCallBatch_
+{
+  struct SrefCallBatch_ *next;
+  unsigned int n_used;
+  SrefCall calls[SREF_NCALLS];
+} SrefCallBatch;
+
+/* Batches are kept on the heap, newest first, so that grace periods can
+ * take them over by relinking pointers, and run them after dropping the
+ * registry locks. */
+static int
+sref_calls_add (SrefCallBatch **headp, void *ptr, void (*cb) (void *))
+{
+  SrefCallBatch *bp = *headp;
+  if (!bp || bp->n_used == SREF_NCALLS)
+    {
+      bp = (SrefCallBatch *)malloc (sizeof (*bp));
+      if (!bp)
+        return (-1);
+
+      bp->n_used = 0;
+      bp->next = *headp;
+      *headp = bp;
+    }
+
+  bp->calls[bp->n_used].ptr = ptr;
+  bp->calls[bp->n_used].cb = cb;
+  ++bp->n_used;
+  return (0);
+}
+
+static inline int
+sref_calls_pending_p (SrefCallBatch *const *headp)
+{
+  return (*headp != NULL);
+}
+
+/* Move the batches in SRCP in front of those in DSTP. */
+static void
+sref_calls_splice (SrefCallBatch **dstp, SrefCallBatch **srcp)
+{
+  SrefCallBatch *last = *srcp;
+  if (!last)
+    return;
+
+  while (last->next)
+    last = last->next;
+
+  last->next = *dstp;
+  *dstp = *srcp;
+  *srcp = NULL;
+}
+
+/* Run and free the batches in BP. Callbacks may queue further callbacks,
+ * but those end up in the batches for the other phase. */
+static void
+sref_calls_run (SrefCallBatch *bp)
+{
+  while (bp)
+    {
+      SrefCallBatch *next = bp->next;
+      for (unsigned int i = 0; i < bp->n_used; ++i)
+        bp->calls[i].cb (bp->calls[i].ptr);
+
+      free (bp);
+      bp = next;
+    }
+}
+
+static void
+sref_calls_fini (SrefCallBatch **headp)
+{
+  /* Callbacks queued by finalizers after the last flush are lost. */
+  for (SrefCallBatch *bp = *headp; bp; )
+    {
+      SrefCallBatch *next = bp->next;
+      free (bp);
+      bp = next;
     }
+
+  *headp = NULL;
 }
 
 typedef struct Dlist
@@ -152,65 +486,342 @@ dlist_splice (Dlist *head, Dlist *dst)
  * Once a thread uses the sref API, it's lazily added to the registry, and
  * will be inspected when a grace period elapses.
  *
- * The registry has 2 locks: One to serialize a thread being registered,
- * and one to serialize thread processing on each grace period.
+ * Registering doesn't take any lock: Threads push themselves onto a stack
+ * of pending threads, which are adopted into the registry proper by the
+ * grace period side, before it polls the threads in the registry.
+ *
+ * Exiting threads don't wait for a grace period either: They hand their
+ * pending tables over to the registry as orphans, which are processed by
+ * the next grace period to flip the phase, and unregister right away.
+ *
+ * Threads and orphans are kept in a sub-registry for the NUMA node they
+ * run on, so that they mostly touch memory local to it. There is still a
+ * single phase, and grace periods go through every node. The topology can
+ * be simulated by setting SREF_NUMA_NODES in the environment.
+ *
+ * The registry has 2 locks: One to serialize access to the registered
+ * threads, and one to serialize thread processing on each grace period.
  */
 
 static const uintptr_t GP_PHASE_BIT = 1;
 
+/* Nodes past this limit share the sub-registries of the lower ones. */
+#ifndef SREF_MAX_NODES
+#  define SREF_MAX_NODES   8
+#endif
+
 typedef struct
 {
-  uintptr_t counter;
+  uintptr_t pending;
   Dlist root;
+  struct SrefOrphan_ *orphans[2];
+} SrefNode;
+
+typedef struct
+{
+  uintptr_t counter;
+  unsigned int waiting;
+  SrefNode nodes[SREF_MAX_NODES];
+  unsigned int n_nodes;
+  int simulated;
+  uintptr_t next_node;
   Sref *review;
+  uintptr_t dead;
+  SrefCallBatch *calls;
+  uintptr_t gp_cost;
   xmutex_t td_lock;
   xmutex_t gp_lock;
+#ifdef SREF_STATS
+  SrefStats retired;
+#endif
 } SrefRegistry;
 
+/* Acquiring and releasing an object both add to the same net delta, so
+ * that matching pairs within a phase cancel out and never touch the object
+ * itself when applied. */
 typedef struct
 {
-  SrefTable refs;
-  SrefTable unrefs;
+  SrefTable deltas;
+  SrefCallBatch *calls;
   int flush;
+  uintptr_t tick;
 } SrefCache;
 
+static inline int
+sref_cache_pending_p (const SrefCache *cache)
+{
+  return (cache->deltas.n_used || sref_calls_pending_p (&cache->calls));
+}
+
+/* Move the deltas and callbacks in SRC over to DST, leaving SRC empty. */
+static void
+sref_cache_move (SrefCache *dst, SrefCache *src)
+{
+  SrefTable *dt = &dst->deltas, *st = &src->deltas;
+  if (st->keys != st->inline_keys)
+    {
+      dt->keys = st->keys;
+      dt->vals = st->vals;
+    }
+  else
+    {
+      memcpy (dt->inline_keys, st->inline_keys, sizeof (st->inline_keys));
+      memcpy (dt->inline_vals, st->inline_vals, sizeof (st->inline_vals));
+      memset (st->inline_keys, 0, sizeof (st->inline_keys));
+      memset (st->inline_vals, 0, sizeof (st->inline_vals));
+      dt->keys = dt->inline_keys;
+      dt->vals = dt->inline_vals;
+    }
+
+  dt->n_used = st->n_used;
+  dt->n_max = st->n_max;
+  dt->load = st->load;
+  dt->limit = st->limit;
+  sref_table_init (st);
+
+  dst->calls = src->calls;
+  src->calls = NULL;
+  dst->flush = 0;
+}
+
+/* The tables of a thread that exited before they could be processed. */
+typedef struct SrefOrphan_
+{
+  struct SrefOrphan_ *next;
+  SrefCache cache;
+} SrefOrphan;
+
 /* Global variables initialized in 'sref_init'. */
 
 static SrefRegistry registry;
 static xkey_t reg_key;
 
+/* Iterate over the threads registered on every node. */
+#define registry_foreach(rp, qp)   \
+  for (SrefNode *qp##_np = (rp)->nodes;   \
+       qp##_np != (rp)->nodes + (rp)->n_nodes; ++qp##_np)   \
+    for (Dlist *qp = qp##_np->root.next; qp != &qp##_np->root; qp = qp->next)
+
+/* Iterate over the orphans for phase IDX on every node. */
+#define registry_foreach_orphan(rp, idx, op)   \
+  for (SrefNode *op##_np = (rp)->nodes;   \
+       op##_np != (rp)->nodes + (rp)->n_nodes; ++op##_np)   \
+    for (SrefOrphan *op = op##_np->orphans[idx]; op; op = op->next)
+
 /*
  * Thread data.
  *
- * Each thread maintains 2 tables: One for reference count increments,
- * and another for decrements. They are separated so that checks for liveness -
- * i.e: refcount != 0 - can be made only when decrementing instead of every
- * time.
+ * Each thread maintains a table that maps objects to the net delta of their
+ * reference counts, so that an acquire and a release of the same object
+ * cancel out. Positive deltas are applied before negative ones, so that
+ * checks for liveness - i.e: refcount != 0 - need only be made for the
+ * latter.
  *
- * We further need 2 sets of these tables so that acquiring and releasing an
- * sref pointer can be done concurrently with registry synchronization that
- * occurs at a different window.
+ * We further need 2 of these tables, one per phase, so that acquiring and
+ * releasing an sref pointer can be done concurrently with registry
+ * synchronization that occurs at a different window.
  */
 
-typedef struct
+typedef struct SrefData_
 {
   Dlist link;
-  uintptr_t counter;
-  uintptr_t n_ops;
+  struct SrefData_ *next_pending;
+  unsigned int node;
+  unsigned int capacity;
+  int fixed_ops;
+  SrefLocal *pub;
   SrefCache cache[2];
+#ifdef SREF_STATS
+  SrefStats *stats;
+#endif
 } SrefData;
 
 /* Thread-specific descriptor for sref operations. */
 
 static xthread_local SrefData local_data;
 
+/* The part of the descriptor that the inline fast paths in <sref.h> use. It
+ * holds the counter and the number of operations, and mirrors the location
+ * of the delta tables. TLS can only be exported with ELF-style toolchains. */
+
+#if defined (__GNUC__) || defined (__clang__)
+__thread SrefLocal SREF_LOCAL;
+#  define local_pub   SREF_LOCAL
+#else
+static xthread_local SrefLocal local_pub;
+#endif
+
+/* Update the view of the tables that the inline fast paths use. This needs
+ * to be done every time a table is moved around. */
+static void
+sref_local_publish (SrefData *dp)
+{
+  SrefLocal *lp = dp->pub;
+  for (int i = 0; i < 2; ++i)
+    {
+      SrefTable *tp = &dp->cache[i].deltas;
+      lp->tables[i].keys = tp->keys;
+      lp->tables[i].vals = tp->vals;
+      lp->tables[i].n_used = &tp->n_used;
+      lp->tables[i].flush = &dp->cache[i].flush;
+      lp->tables[i].mask = (tp->n_max - 1) & ~(XGROUP_SIZE - 1);
+      lp->tables[i].limit = tp->limit;
+    }
+}
+
+static int
+sref_local_grow (SrefData *dp, SrefTable *tp)
+{
+  if (sref_table_grow (tp) < 0)
+    return (-1);
+
+  sref_local_publish (dp);
+  return (0);
+}
+
+/* Pick the node for the calling thread. A simulated topology spreads the
+ * threads evenly among the nodes. */
+static unsigned int
+registry_node (SrefRegistry *regp)
+{
+  if (regp->n_nodes == 1)
+    return (0);
+  else if (!regp->simulated)
+    return (xnuma_node () % regp->n_nodes);
+
+  uintptr_t prev = xatomic_load_rlx (&regp->next_node);
+  while (1)
+    {
+      uintptr_t tmp = xatomic_cas (&regp->next_node, prev, prev + 1);
+      if (tmp == prev)
+        return ((unsigned int)(prev % regp->n_nodes));
+
+      prev = tmp;
+    }
+}
+
 static void
 registry_add (SrefRegistry *regp, SrefData *dp)
 {
+  SrefLocal *lp = &local_pub;
+  for (int i = 0; i < 2; ++i)
+    {
+      SrefTable *tp = &dp->cache[i].deltas;
+      sref_table_init (tp);
+      if (sref_table_setup (tp, lib_config.capacity, lib_config.load) < 0)
+        /* Fall back to the inline storage. */
+        sref_table_init (tp);
+    }
+
+  dp->capacity = dp->cache[0].deltas.n_max;
+  dp->fixed_ops = 0;
+
+  dp->pub = lp;
+  lp->max_ops = lib_config.max_ops;
+  lp->gp_counter = &regp->counter;
+  lp->gp_waiting = &regp->waiting;
+  sref_local_publish (dp);
+
+#ifdef SREF_USE_MEMBARRIER
+  lp->light_fence = 1;
+#endif
+
+#ifdef SREF_STATS
+  dp->stats = &local_stats;
+#else
+  /* The fast paths don't collect statistics, so they're disabled if we do. */
+  lp->ready = 1;
+#endif
+
   xkey_set (reg_key, dp);
-  xmutex_lock (&regp->td_lock);
-  dlist_add (&regp->root, &dp->link);
-  xmutex_unlock (&regp->td_lock);
+
+  /* Mark ourselves as registered, and wait to be adopted. */
+  dlist_init_head (&dp->link);
+  dp->node = registry_node (regp);
+
+  SrefNode *np = &regp->nodes[dp->node];
+  uintptr_t prev = xatomic_load_rlx (&np->pending);
+  while (1)
+    {
+      dp->next_pending = (SrefData *)prev;
+      uintptr_t tmp = xatomic_cas (&np->pending, prev, (uintptr_t)dp);
+      if (tmp == prev)
+        break;
+
+      prev = tmp;
+    }
+}
+
+/* Move the pending threads of a node into the list READERS. Only the grace
+ * period side may do this, with both registry locks held: A thread adopted
+ * anywhere else could land in the middle of one, and skip being polled. */
+static void
+registry_adopt (SrefNode *np, Dlist *readers)
+{
+  uintptr_t prev = xatomic_load_acq (&np->pending);
+  while (prev)
+    {
+      uintptr_t tmp = xatomic_cas (&np->pending, prev, 0);
+      if (tmp == prev)
+        break;
+
+      prev = tmp;
+    }
+
+  for (SrefData *dp = (SrefData *)prev; dp; dp = dp->next_pending)
+    dlist_add (readers, &dp->link);
+}
+
+/* Take DP off the stack of pending threads of node NP. Must be called with
+ * the thread registry lock held, so that nobody else pops from it. */
+static void
+registry_unpend (SrefNode *np, SrefData *dp)
+{
+  uintptr_t prev = xatomic_load_acq (&np->pending);
+  while (prev)
+    {
+      uintptr_t tmp = xatomic_cas (&np->pending, prev, 0);
+      if (tmp == prev)
+        break;
+
+      prev = tmp;
+    }
+
+  /* Push back everyone else, on top of whoever registered meanwhile. */
+  SrefData *first = NULL, *last = NULL;
+  for (SrefData *next, *runp = (SrefData *)prev; runp; runp = next)
+    {
+      next = runp->next_pending;
+      if (runp == dp)
+        continue;
+      else if (last)
+        last->next_pending = runp;
+      else
+        first = runp;
+
+      last = runp;
+    }
+
+  if (!first)
+    return;
+
+  prev = xatomic_load_rlx (&np->pending);
+  while (1)
+    {
+      last->next_pending = (SrefData *)prev;
+      uintptr_t tmp = xatomic_cas (&np->pending, prev, (uintptr_t)first);
+      if (tmp == prev)
+        break;
+
+      prev = tmp;
+    }
+}
+
+static void
+registry_adopt_all (SrefRegistry *regp)
+{
+  for (unsigned int i = 0; i < regp->n_nodes; ++i)
+    registry_adopt (&regp->nodes[i], &regp->nodes[i].root);
 }
 
 static uintptr_t
@@ -232,46 +843,103 @@ sref_local (void)
 static uintptr_t
 local_counter (const SrefData *dp)
 {
-  return (xatomic_load_rlx (&dp->counter));
+  return (xatomic_load_rlx (&dp->pub->counter));
 }
 
-#define sref_table_process(table, dec)   \
-  do   \
-    {   \
-      for (unsigned int i = 0, j = 0; j < (table)->n_used; ++i)   \
-        {   \
-          SrefDelta *dep = &(table)->deltas[i];   \
-          if (!dep->ptr)   \
-            continue;   \
-          \
-          Sref *p = (Sref *)dep->ptr;   \
-          p->refcnt += dep->delta;   \
-          assert (p->refcnt >= 0);   \
-          if (dec && !p->refcnt && p->fini)   \
-            p->fini (p);   \
-          \
-          dep->ptr = NULL;   \
-          dep->delta = 0;   \
-          ++j;   \
-        }   \
-      \
-      (table)->n_used = 0;   \
-    }   \
-  while (0)
+/* Terminates the lists of objects linked through their 'next' member, so
+ * that a non-null link always means an object is on one of them. */
+static Sref sref_list_end;
 
-static void
-sref_process_inc (SrefData *dp, uintptr_t idx)
-{
-  sref_table_process (&dp->cache[idx].refs, 0);
-}
+#define SREF_LIST_END   (&sref_list_end)
 
+/* Queue an object whose reference count dropped to zero, so that its
+ * finalizer runs once the registry locks are dropped. Helper threads may
+ * call this concurrently. */
 static void
-sref_process_dec (SrefData *dp, uintptr_t idx)
+sref_fini_defer (SrefRegistry *rp, Sref *p)
 {
-  sref_table_process (&dp->cache[idx].unrefs, 1);
-}
+  if (p->next)
+    /* It's on the review list, which will find it dead. */
+    return;
+
+  uintptr_t prev = xatomic_load_rlx (&rp->dead);
+  while (1)
+    {
+      p->next = (Sref *)prev;
+      uintptr_t tmp = xatomic_cas (&rp->dead, prev, (uintptr_t)p);
+      if (tmp == prev)
+        break;
+
+      prev = tmp;
+    }
+}
 
-#undef sref_table_process
+/* Run the finalizers for a list of dead objects. */
+static void
+sref_fini_run (Sref *sp)
+{
+#ifdef SREF_USE_SDT
+  /* Only worth walking the list for when the probes are compiled in. */
+  size_t n = 0;
+  for (Sref *p = sp; p != SREF_LIST_END; p = p->next)
+    ++n;
+
+  xtrace2 (fini__batch, sp, n);
+#endif
+
+  while (sp != SREF_LIST_END)
+    {
+      Sref *next = sp->next;
+      sp->next = NULL;
+      SREF_STAT_INC (n_fini);
+      sp->fini (sp);
+      sp = next;
+    }
+}
+
+/* Apply the delta at slot IDX of a table, and clear the slot. Only negative
+ * deltas can make a reference count drop to zero, so they are the only ones
+ * that need checking, and net deltas of zero are skipped entirely. */
+static inline void
+sref_delta_apply (SrefTable *tp, unsigned int idx)
+{
+  Sref *p = (Sref *)tp->keys[idx];
+  intptr_t delta = tp->vals[idx];
+
+  if (delta)
+    {
+      p->refcnt += delta;
+      assert (p->refcnt >= 0);
+      SREF_STAT_INC (n_deltas);
+      if (delta < 0 && !p->refcnt && p->fini)
+        sref_fini_defer (&registry, p);
+    }
+
+  tp->keys[idx] = NULL;
+  tp->vals[idx] = 0;
+}
+
+/* Increments are applied for every thread before any decrement, so that
+ * an object isn't finalized while a reference to it is still pending. */
+static void
+sref_process_inc (SrefTable *tp)
+{
+  sref_keys_foreach (tp->keys, tp->n_used, i)
+    if (tp->vals[i] > 0)
+      {
+        sref_delta_apply (tp, i);
+        --tp->n_used;
+      }
+}
+
+static void
+sref_process_dec (SrefTable *tp)
+{
+  sref_keys_foreach (tp->keys, tp->n_used, i)
+    sref_delta_apply (tp, i);
+
+  tp->n_used = 0;
+}
 
 #define STATE_ACTIVE     0
 #define STATE_INACTIVE   1
@@ -280,7 +948,7 @@ sref_process_dec (SrefData *dp, uintptr_t idx)
 static inline int
 local_state (SrefData *dp)
 {
-  uintptr_t val = xatomic_load_acq (&dp->counter);
+  uintptr_t val = xatomic_load_acq (&dp->pub->counter);
   if (!(val >> GP_PHASE_BIT))
     return (STATE_INACTIVE);
   else if (!((val ^ registry_counter ()) & GP_PHASE_BIT))
@@ -289,11 +957,29 @@ local_state (SrefData *dp)
     return (STATE_OLD);
 }
 
+/* Number of times we spin before going to sleep when polling readers. */
+#define REGISTRY_NSPINS   1000
+
 static void
-registry_poll (SrefRegistry *regp, Dlist *readers, Dlist *outp, Dlist *qsp)
+registry_poll (SrefRegistry *regp, SrefNode *np,
+               Dlist *readers, Dlist *outp, Dlist *qsp)
 {
-  for (unsigned int loops = 0 ; ; ++loops)
+  /* A thread that registers after this may have read the phase before it
+   * was flipped, so we adopt pending threads before every pass. Those that
+   * register later are bound to see the new phase. */
+  registry_adopt (np, readers);
+
+  unsigned int loops = 0;
+  for ( ; ; loops += loops < REGISTRY_NSPINS)
     {
+      if (loops >= REGISTRY_NSPINS)
+        { /* Ask readers to wake us up when they leave their critical
+           * sections. Any reader that leaves before this store is seen
+           * will be caught by the scan below. */
+          xatomic_store_rel_int (&regp->waiting, 1);
+          xatomic_mfence_full ();
+        }
+
       Dlist *next, *runp = readers->next;
       for (; runp != readers; runp = next)
         {
@@ -327,16 +1013,20 @@ registry_poll (SrefRegistry *regp, Dlist *readers, Dlist *outp, Dlist *qsp)
 
       xmutex_unlock (&regp->td_lock);
 
-      if (loops < 1000)
+      if (loops < REGISTRY_NSPINS)
         xatomic_mfence_acq ();
       else
-        {
-          xthread_sleep (1);
-          loops = 0;
+        { /* The timeout covers for wakeups lost to readers that didn't see
+           * the store to the 'waiting' flag in time. */
+          xtrace1 (poll__sleep, regp);
+          xfutex_wait (&regp->waiting, 1, 1);
         }
 
       xmutex_lock (&regp->td_lock);
     }
+
+  if (loops >= REGISTRY_NSPINS)
+    xatomic_store_rel_int (&regp->waiting, 0);
 }
 
 static void
@@ -353,6 +1043,632 @@ registry_unlock (SrefRegistry *rp)
   xmutex_unlock (&rp->gp_lock);
 }
 
+/*
+ * Parallel delta application.
+ *
+ * When enabled, a pool of helper threads assists the thread running a grace
+ * period in applying the deltas. These are partitioned by pointer hash, so
+ * that every object is handled by a single worker; this preserves the
+ * invariant that all the increments for an object land before its reference
+ * count is checked for zero.
+ *
+ * In NUMA mode, the helpers are instead spread evenly among the nodes and
+ * bound to them, and the deltas for an object go to a helper on the node
+ * that holds its memory, so that reference counts are written locally. The
+ * node of each page is cached, and lookups that miss the cache fall back to
+ * hashing until the grace period is over, when the misses are resolved; the
+ * cache is never written while helpers run, so they all agree on it.
+ *
+ * The helpers are started and stopped with the grace period lock held, so
+ * that a running grace period always sees a consistent pool.
+ */
+
+#ifndef SREF_MAX_HELPERS
+#  define SREF_MAX_HELPERS   16
+#endif
+
+#if SREF_MAX_HELPERS < SREF_MAX_NODES
+#  error "SREF_MAX_HELPERS must be at least SREF_MAX_NODES"
+#endif
+
+/* Minimum number of deltas for which it's worth waking the helpers. */
+#ifndef SREF_PARALLEL_MIN
+#  define SREF_PARALLEL_MIN   2048
+#endif
+
+/* Number of entries in the cache of page nodes. */
+#ifndef SREF_NUMA_NPAGES
+#  define SREF_NUMA_NPAGES   4096
+#endif
+
+/* Number of cache misses that each helper records per grace period. */
+#define NUMA_NMISSES   64
+
+#define NUMA_PAGE_SHIFT   12
+
+typedef struct
+{
+  xmutex_t lock;
+  xcond_t start_cv;
+  xcond_t done_cv;
+  xthread_t threads[SREF_MAX_HELPERS];
+  unsigned int n_threads;
+  unsigned int n_ready;
+  unsigned int n_pending;
+  uintptr_t gen;
+  uintptr_t idx;
+  int numa;
+  int running;
+  int initialized;
+  uintptr_t misses[SREF_MAX_HELPERS + 1][NUMA_NMISSES];
+  unsigned int n_misses[SREF_MAX_HELPERS + 1];
+} SrefHelpers;
+
+static SrefHelpers helpers;
+
+/* Each entry holds a page number, followed by its node plus 1. */
+static uintptr_t numa_pages[SREF_NUMA_NPAGES];
+
+static inline unsigned int
+sref_part (void *ptr, unsigned int n_parts)
+{
+  uint64_t hval = (uint64_t)((uintptr_t)ptr >> 3) * 0x9e3779b97f4a7c15ull;
+  return ((unsigned int)((hval >> 32) % n_parts));
+}
+
+/* Return the node that holds PTR, as far as we know. */
+static unsigned int
+helpers_node (SrefHelpers *hp, unsigned int part, void *ptr)
+{
+  SrefRegistry *rp = &registry;
+  uintptr_t page = (uintptr_t)ptr >> NUMA_PAGE_SHIFT;
+
+  if (rp->simulated)
+    return ((unsigned int)(page % rp->n_nodes));
+
+  uintptr_t ent = numa_pages[page % SREF_NUMA_NPAGES];
+  if ((ent >> 8) == page && (ent & 0xff))
+    return ((unsigned int)(ent & 0xff) - 1);
+  else if (hp->n_misses[part] < NUMA_NMISSES)
+    hp->misses[part][hp->n_misses[part]++] = page;
+
+  return (sref_part (ptr, rp->n_nodes));
+}
+
+/* Fill in the nodes for the pages that the helpers missed. */
+static void
+helpers_resolve (SrefHelpers *hp)
+{
+  for (unsigned int i = 0; i <= hp->n_threads; ++i)
+    {
+      for (unsigned int j = 0; j < hp->n_misses[i]; ++j)
+        {
+          uintptr_t page = hp->misses[i][j];
+          unsigned int node =
+            xnuma_addr_node ((void *)(page << NUMA_PAGE_SHIFT));
+
+          if (node < registry.n_nodes)
+            numa_pages[page % SREF_NUMA_NPAGES] = (page << 8) | (node + 1);
+        }
+
+      hp->n_misses[i] = 0;
+    }
+}
+
+/* Return the part of the helper that handles PTR. Part 0 belongs to the
+ * thread running the grace period, which sits out in NUMA mode; helper I
+ * is then bound to node (I - 1) % N. */
+static inline unsigned int
+helpers_part (SrefHelpers *hp, unsigned int part, void *ptr)
+{
+  if (!hp->numa)
+    return (sref_part (ptr, hp->n_threads + 1));
+
+  unsigned int n_nodes = registry.n_nodes;
+  unsigned int node = helpers_node (hp, part, ptr);
+  unsigned int n = (hp->n_threads - node + n_nodes - 1) / n_nodes;
+
+  return (1 + node + n_nodes * sref_part (ptr, n));
+}
+
+static void
+sref_table_process_part (SrefTable *tp, int dec, unsigned int part)
+{
+  SrefHelpers *hp = &helpers;
+  for (unsigned int i = 0; i < tp->n_max; i += XGROUP_SIZE)
+    {
+      unsigned int bits = xgroup_match (tp->keys + i, NULL) ^ XGROUP_MASK;
+      for (unsigned int j = i; bits; bits >>= 1, ++j)
+        if ((bits & 1) && (dec || tp->vals[j] > 0) &&
+            helpers_part (hp, part, tp->keys[j]) == part)
+          sref_delta_apply (tp, j);
+    }
+}
+
+static void
+registry_apply_part (SrefRegistry *rp, uintptr_t idx, unsigned int part)
+{
+  registry_foreach (rp, qp)
+    sref_table_process_part (&((SrefData *)qp)->cache[idx].deltas, 0, part);
+
+  registry_foreach_orphan (rp, idx, op)
+    sref_table_process_part (&op->cache.deltas, 0, part);
+
+  registry_foreach (rp, qp)
+    sref_table_process_part (&((SrefData *)qp)->cache[idx].deltas, 1, part);
+
+  registry_foreach_orphan (rp, idx, op)
+    sref_table_process_part (&op->cache.deltas, 1, part);
+}
+
+static XTHREAD_RET
+helper_run (void *arg)
+{
+  SrefHelpers *hp = &helpers;
+  unsigned int part = (unsigned int)(uintptr_t)arg;
+  uintptr_t gen;
+
+  if (hp->numa && !registry.simulated)
+    (void)xnuma_bind ((part - 1) % registry.n_nodes);
+
+  /* Register ourselves before being handed any work. Registering doesn't
+   * take the registry locks, since new threads are queued until the next
+   * grace period adopts them, but it allocates the delta tables, and that is
+   * better done now than while a grace period is waiting on us. */
+  sref_local ();
+  xmutex_lock (&hp->lock);
+  gen = hp->gen;   /* The pool may have been restarted. */
+  ++hp->n_ready;
+  xcond_signal (&hp->done_cv);
+
+  while (1)
+    {
+      if (!hp->running)
+        break;
+      else if (hp->gen == gen)
+        {
+          xcond_wait (&hp->start_cv, &hp->lock);
+          continue;
+        }
+
+      gen = hp->gen;
+      xmutex_unlock (&hp->lock);
+      registry_apply_part (&registry, hp->idx, part);
+      xmutex_lock (&hp->lock);
+
+      if (--hp->n_pending == 0)
+        xcond_signal (&hp->done_cv);
+    }
+
+  xmutex_unlock (&hp->lock);
+  return (0);
+}
+
+static void
+helpers_stop (SrefHelpers *hp)
+{
+  if (!hp->running)
+    return;
+
+  /* Exiting helpers need the grace period lock to unregister themselves,
+   * so it must be dropped before joining them. */
+  xmutex_lock (&registry.gp_lock);
+  xmutex_lock (&hp->lock);
+  hp->running = 0;
+  xcond_broadcast (&hp->start_cv);
+  xmutex_unlock (&hp->lock);
+  xmutex_unlock (&registry.gp_lock);
+
+  for (unsigned int i = 0; i < hp->n_threads; ++i)
+    xthread_join (hp->threads[i]);
+
+  hp->n_threads = 0;
+}
+
+static int
+helpers_start (SrefHelpers *hp, int numa)
+{
+  if (hp->running && hp->numa == numa)
+    return (0);
+
+  helpers_stop (hp);
+  if (!hp->initialized)
+    {
+      if (xmutex_init (&hp->lock) < 0)
+        return (-1);
+      else if (xcond_init (&hp->start_cv) < 0)
+        {
+          xmutex_destroy (&hp->lock);
+          return (-1);
+        }
+      else if (xcond_init (&hp->done_cv) < 0)
+        {
+          xcond_destroy (&hp->start_cv);
+          xmutex_destroy (&hp->lock);
+          return (-1);
+        }
+
+      hp->initialized = 1;
+    }
+
+  /* Use every other CPU unless configured otherwise, but at least one
+   * helper since it was asked for. */
+  unsigned int n = lib_config.helpers ? lib_config.helpers : xcpu_count () - 1;
+  if (n == 0)
+    n = 1;
+  else if (n > SREF_MAX_HELPERS)
+    n = SREF_MAX_HELPERS;
+
+  /* Every node needs at least a helper of its own. */
+  if (numa && n < registry.n_nodes)
+    n = registry.n_nodes;
+
+  xmutex_lock (&registry.gp_lock);
+  hp->n_threads = hp->n_ready = 0;
+  hp->numa = numa;
+  hp->running = 1;
+
+  for (; hp->n_threads < n; ++hp->n_threads)
+    if (xthread_create (&hp->threads[hp->n_threads], helper_run,
+                        (void *)(uintptr_t)(hp->n_threads + 1)) < 0)
+      break;
+
+  xmutex_lock (&hp->lock);
+  while (hp->n_ready < hp->n_threads)
+    xcond_wait (&hp->done_cv, &hp->lock);
+  xmutex_unlock (&hp->lock);
+
+  xmutex_unlock (&registry.gp_lock);
+  if (hp->n_threads < n)
+    {
+      helpers_stop (hp);
+      return (-1);
+    }
+
+  return (0);
+}
+
+/* Apply the deltas for phase IDX with the help of the helper threads.
+ * Returns 0 if there isn't enough work for them. */
+static int
+registry_apply_parallel (SrefRegistry *rp, uintptr_t idx)
+{
+  SrefHelpers *hp = &helpers;
+  if (!hp->running)
+    return (0);
+
+  uintptr_t n_deltas = 0;
+  registry_foreach (rp, qp)
+    n_deltas += ((SrefData *)qp)->cache[idx].deltas.n_used;
+
+  registry_foreach_orphan (rp, idx, op)
+    n_deltas += op->cache.deltas.n_used;
+
+  if (n_deltas < SREF_PARALLEL_MIN)
+    return (0);
+
+  xmutex_lock (&hp->lock);
+  hp->idx = idx;
+  hp->n_pending = hp->n_threads;
+  ++hp->gen;
+  xcond_broadcast (&hp->start_cv);
+  xmutex_unlock (&hp->lock);
+
+  if (!hp->numa)
+    registry_apply_part (rp, idx, 0);
+
+  xmutex_lock (&hp->lock);
+  while (hp->n_pending)
+    xcond_wait (&hp->done_cv, &hp->lock);
+  xmutex_unlock (&hp->lock);
+
+  registry_foreach (rp, qp)
+    ((SrefData *)qp)->cache[idx].deltas.n_used = 0;
+
+  registry_foreach_orphan (rp, idx, op)
+    op->cache.deltas.n_used = 0;
+
+  if (hp->numa)
+    helpers_resolve (hp);
+
+  return (1);
+}
+
+/*
+ * Merged delta application.
+ *
+ * With many threads, the same objects tend to show up in most of their
+ * tables, and applying every table in turn means writing to each of those
+ * reference counts once per thread, in hash order. Past a number of tables,
+ * the thread running the grace period instead gathers every delta, sorts
+ * them by address and combines the ones for the same object, so that each
+ * reference count is written once, in order, and can be prefetched.
+ */
+
+/* Minimum number of tables for which deltas are merged. */
+#ifndef SREF_MERGE_MIN
+#  define SREF_MERGE_MIN   8
+#endif
+
+/* How many objects ahead we prefetch when applying merged deltas. */
+#define MERGE_PREFETCH   8
+
+typedef struct
+{
+  void *ptr;
+  intptr_t delta;
+} SrefDelta;
+
+/* Scratch space, only used with the grace period lock held. */
+static SrefDelta *merge_buf;
+static size_t merge_max;
+
+static int
+sref_delta_cmp (const void *x, const void *y)
+{
+  uintptr_t a = (uintptr_t)((const SrefDelta *)x)->ptr;
+  uintptr_t b = (uintptr_t)((const SrefDelta *)y)->ptr;
+  return ((a > b) - (a < b));
+}
+
+/* Move the non-zero deltas of a table to OUT, clearing it. */
+static size_t
+sref_table_gather (SrefTable *tp, SrefDelta *out)
+{
+  size_t ret = 0;
+  sref_keys_foreach (tp->keys, tp->n_used, i)
+    {
+      if (tp->vals[i])
+        {
+          out[ret].ptr = tp->keys[i];
+          out[ret++].delta = tp->vals[i];
+        }
+
+      tp->keys[i] = NULL;
+      tp->vals[i] = 0;
+    }
+
+  tp->n_used = 0;
+  return (ret);
+}
+
+static void
+sref_merged_apply (SrefDelta *deltas, size_t n, int dec)
+{
+  for (size_t i = 0; i < n; ++i)
+    {
+      if (i + MERGE_PREFETCH < n)
+        xprefetch (deltas[i + MERGE_PREFETCH].ptr);
+
+      intptr_t delta = deltas[i].delta;
+      if (!delta || (delta < 0) != dec)
+        continue;
+
+      Sref *p = (Sref *)deltas[i].ptr;
+      p->refcnt += delta;
+      assert (p->refcnt >= 0);
+      SREF_STAT_INC (n_deltas);
+
+      if (dec && !p->refcnt && p->fini)
+        sref_fini_defer (&registry, p);
+    }
+}
+
+/* Apply the deltas for phase IDX with a single write per object. Returns 0
+ * if there are too few tables for it to be worth it. */
+static int
+registry_apply_merged (SrefRegistry *rp, uintptr_t idx)
+{
+  size_t n_tables = 0, n_deltas = 0;
+
+  registry_foreach (rp, qp)
+    {
+      n_deltas += ((SrefData *)qp)->cache[idx].deltas.n_used;
+      ++n_tables;
+    }
+
+  registry_foreach_orphan (rp, idx, op)
+    {
+      n_deltas += op->cache.deltas.n_used;
+      ++n_tables;
+    }
+
+  if (n_tables < SREF_MERGE_MIN)
+    return (0);
+  else if (n_deltas > merge_max)
+    {
+      SrefDelta *buf = (SrefDelta *)realloc (merge_buf,
+                                             n_deltas * sizeof (*buf));
+      if (!buf)
+        return (0);
+
+      merge_buf = buf;
+      merge_max = n_deltas;
+    }
+
+  size_t n = 0;
+  registry_foreach (rp, qp)
+    n += sref_table_gather (&((SrefData *)qp)->cache[idx].deltas,
+                            merge_buf + n);
+
+  registry_foreach_orphan (rp, idx, op)
+    n += sref_table_gather (&op->cache.deltas, merge_buf + n);
+
+  qsort (merge_buf, n, sizeof (*merge_buf), sref_delta_cmp);
+
+  /* Combine the deltas for every object into its first entry. */
+  size_t n_out = 0;
+  for (size_t i = 0; i < n; ++i)
+    if (n_out && merge_buf[n_out - 1].ptr == merge_buf[i].ptr)
+      merge_buf[n_out - 1].delta += merge_buf[i].delta;
+    else
+      merge_buf[n_out++] = merge_buf[i];
+
+  sref_merged_apply (merge_buf, n_out, 0);
+  sref_merged_apply (merge_buf, n_out, 1);
+  return (1);
+}
+
+/*
+ * Finalizer pool.
+ *
+ * Objects whose reference count drops to zero during a grace period are
+ * collected in a list, and their finalizers are run once the registry locks
+ * are dropped, so that a slow finalizer doesn't hold up other flushers or
+ * threads that register. By default, the thread that ran the grace period
+ * runs them; when enabled, a pool of threads does so in batches instead.
+ */
+
+/* Number of finalizers that a pool thread runs in one go. */
+#ifndef SREF_FINI_BATCH
+#  define SREF_FINI_BATCH   64
+#endif
+
+typedef struct
+{
+  xmutex_t lock;
+  xcond_t cv;
+  xthread_t threads[SREF_MAX_HELPERS];
+  unsigned int n_threads;
+  Sref *queue;
+  int running;
+  int initialized;
+} SrefFinalizers;
+
+static SrefFinalizers finalizers;
+
+static XTHREAD_RET
+finalizers_run (void *arg)
+{
+  SrefFinalizers *fp = (SrefFinalizers *)arg;
+
+  /* See 'reclaimer_run'. */
+  sref_local ();
+  xmutex_lock (&fp->lock);
+
+  while (1)
+    {
+      if (fp->queue != SREF_LIST_END)
+        { /* Take a batch off the queue, and leave the rest to others. */
+          Sref *batch = fp->queue, *last = batch;
+          for (int i = 1; i < SREF_FINI_BATCH &&
+              last->next != SREF_LIST_END; ++i)
+            last = last->next;
+
+          fp->queue = last->next;
+          last->next = SREF_LIST_END;
+          xmutex_unlock (&fp->lock);
+          sref_fini_run (batch);
+          xmutex_lock (&fp->lock);
+        }
+      else if (!fp->running)
+        break;
+      else
+        xcond_wait (&fp->cv, &fp->lock);
+    }
+
+  xmutex_unlock (&fp->lock);
+  return (0);
+}
+
+static void
+finalizers_stop (SrefFinalizers *fp)
+{
+  if (!fp->running)
+    return;
+
+  /* The threads run whatever is queued before exiting. */
+  xmutex_lock (&fp->lock);
+  fp->running = 0;
+  xcond_broadcast (&fp->cv);
+  xmutex_unlock (&fp->lock);
+
+  for (unsigned int i = 0; i < fp->n_threads; ++i)
+    xthread_join (fp->threads[i]);
+
+  fp->n_threads = 0;
+}
+
+static int
+finalizers_start (SrefFinalizers *fp)
+{
+  if (fp->running)
+    return (0);
+  else if (!fp->initialized)
+    {
+      if (xmutex_init (&fp->lock) < 0)
+        return (-1);
+      else if (xcond_init (&fp->cv) < 0)
+        {
+          xmutex_destroy (&fp->lock);
+          return (-1);
+        }
+
+      fp->queue = SREF_LIST_END;
+      fp->initialized = 1;
+    }
+
+  fp->running = 1;
+  for (unsigned int i = 0; i < lib_config.finalizers; ++i)
+    {
+      if (xthread_create (&fp->threads[i], finalizers_run, fp) < 0)
+        {
+          finalizers_stop (fp);
+          return (-1);
+        }
+
+      ++fp->n_threads;
+    }
+
+  return (0);
+}
+
+/* Run the finalizers for the objects in DEAD, or hand them to the pool. */
+static void
+finalizers_dispatch (SrefFinalizers *fp, Sref *dead)
+{
+  if (dead == SREF_LIST_END)
+    return;
+  else if (xatomic_load_rlx (&fp->running))
+    {
+      Sref *last = dead;
+      while (last->next != SREF_LIST_END)
+        last = last->next;
+
+      xmutex_lock (&fp->lock);
+      if (fp->running)
+        {
+          last->next = fp->queue;
+          fp->queue = dead;
+          dead = SREF_LIST_END;
+          xcond_broadcast (&fp->cv);
+        }
+
+      xmutex_unlock (&fp->lock);
+    }
+
+  sref_fini_run (dead);
+}
+
+/* Drop the registry locks, and then run the callbacks and finalizers left
+ * by the grace periods run while holding them. Either may take arbitrarily
+ * long, or use the API, so they can't run with the locks held. */
+static void
+registry_release (SrefRegistry *rp)
+{
+  Sref *dead = (Sref *)rp->dead;
+  SrefCallBatch *calls = rp->calls;
+
+  rp->dead = (uintptr_t)SREF_LIST_END;
+  rp->calls = NULL;
+  registry_unlock (rp);
+
+  sref_calls_run (calls);
+  finalizers_dispatch (&finalizers, dead);
+}
+
+/* Run a grace period. Unless ACQUIRE is set, the caller holds the registry
+ * locks, and must drop them with 'registry_release'. */
 static void
 registry_sync (int acquire)
 {
@@ -361,7 +1677,19 @@ registry_sync (int acquire)
   if (acquire)
     registry_lock (rp);
 
-  if (dlist_empty_p (&rp->root))
+  registry_adopt_all (rp);
+
+  /* Only time grace periods if somebody is going to use it. */
+  uint64_t t_cost = xatomic_load_rlx (&lib_config.adapt_max) ? xclock_ns () : 0;
+  int empty = 1;
+  for (unsigned int i = 0; i < rp->n_nodes; ++i)
+    {
+      SrefNode *np = &rp->nodes[i];
+      if (!dlist_empty_p (&np->root) || np->orphans[0] || np->orphans[1])
+        empty = 0;
+    }
+
+  if (empty)
     {
       if (acquire)
         registry_unlock (rp);
@@ -369,43 +1697,349 @@ registry_sync (int acquire)
       return;
     }
 
-  Dlist out, qs;
-  dlist_init_head (&qs);
-  dlist_init_head (&out);
+  Dlist out[SREF_MAX_NODES], qs[SREF_MAX_NODES];
+  for (unsigned int i = 0; i < rp->n_nodes; ++i)
+    {
+      dlist_init_head (&qs[i]);
+      dlist_init_head (&out[i]);
+    }
 
-  xatomic_mfence_full ();
-  registry_poll (rp, &rp->root, &out, &qs);
+  SREF_STAT_CLOCK (t_start);
+  xtrace1 (gp__start, rp);
+  xatomic_mfence_gp ();
+  for (unsigned int i = 0; i < rp->n_nodes; ++i)
+    registry_poll (rp, &rp->nodes[i], &rp->nodes[i].root, &out[i], &qs[i]);
 
   uintptr_t prev_idx = xatomic_load_rlx (&rp->counter);
   xatomic_store_rel (&rp->counter, prev_idx ^ GP_PHASE_BIT);
+  xtrace1 (phase__flip, prev_idx ^ GP_PHASE_BIT);
+
+  /* Threads that were quiescent before the flip may have entered since,
+   * after reading the old phase, and may be adding to the tables we are
+   * about to apply. So every thread is polled again once the flip is seen:
+   * Either it shows up as still in the old phase, or it sees the new one. */
+  xatomic_mfence_gp ();
+  for (unsigned int i = 0; i < rp->n_nodes; ++i)
+    {
+      dlist_splice (&qs[i], &out[i]);
+      dlist_init_head (&qs[i]);
+      registry_poll (rp, &rp->nodes[i], &out[i], NULL, &qs[i]);
+      dlist_splice (&qs[i], &rp->nodes[i].root);
+    }
 
-  registry_poll (rp, &out, NULL, &qs);
-  dlist_splice (&qs, &rp->root);
+  xatomic_mfence_gp ();
+  SREF_STAT_ELAPSED (poll_ns, t_start);
 
   /* Now process increments first, and then decrements, after checking
    * for any object whose refcount is zero, so that it's destroyed timely. */
 
-  for (Dlist *qp = rp->root.next; qp != &rp->root; qp = qp->next)
-    sref_process_inc ((SrefData *)qp, prev_idx);
+  if (!registry_apply_parallel (rp, prev_idx) &&
+      !registry_apply_merged (rp, prev_idx))
+    {
+      registry_foreach (rp, qp)
+        sref_process_inc (&((SrefData *)qp)->cache[prev_idx].deltas);
+
+      registry_foreach_orphan (rp, prev_idx, op)
+        sref_process_inc (&op->cache.deltas);
 
-  for (Dlist *qp = rp->root.next; qp != &rp->root; qp = qp->next)
-    sref_process_dec ((SrefData *)qp, prev_idx);
+      registry_foreach (rp, qp)
+        sref_process_dec (&((SrefData *)qp)->cache[prev_idx].deltas);
 
-  for (Sref *sp = rp->review; sp ; )
+      registry_foreach_orphan (rp, prev_idx, op)
+        sref_process_dec (&op->cache.deltas);
+    }
+
+  if (rp->review != SREF_LIST_END)
+    xtrace1 (review__process, rp->review);
+
+  for (Sref *sp = rp->review; sp != SREF_LIST_END; )
     {
       Sref *next = sp->next;
-      if (sp->refcnt)
-        /* Still live - Clear the review link. */
-        sp->next = NULL;
+
+      /* Either still live, or going onto the list of dead objects. */
+      sp->next = NULL;
+      if (!sp->refcnt && sp->fini)
+        sref_fini_defer (rp, sp);
+
+      sp = next;
+    }
+
+  rp->review = SREF_LIST_END;
+
+  /* Finally, take the callbacks queued before the grace period began.
+   * Like finalizers, they are run once the locks are dropped. */
+  registry_foreach (rp, qp)
+    sref_calls_splice (&rp->calls, &((SrefData *)qp)->cache[prev_idx].calls);
+
+  /* No thread can add orphans for this phase until the next flip. */
+  for (unsigned int i = 0; i < rp->n_nodes; ++i)
+    {
+      for (SrefOrphan *op = rp->nodes[i].orphans[prev_idx]; op; )
+        {
+          SrefOrphan *next = op->next;
+          sref_calls_splice (&rp->calls, &op->cache.calls);
+          sref_table_fini (&op->cache.deltas);
+          free (op);
+          op = next;
+        }
+
+      rp->nodes[i].orphans[prev_idx] = NULL;
+    }
+
+  SREF_STAT_INC (n_gps);
+  SREF_STAT_ELAPSED (sync_ns, t_start);
+  xtrace1 (gp__end, rp);
+
+  if (t_cost)
+    { /* Keep a moving average, weighing the last grace period by 1/8. */
+      uintptr_t cost = (uintptr_t)(xclock_ns () - t_cost);
+      uintptr_t prev = rp->gp_cost;
+      xatomic_store_rel (&rp->gp_cost, prev ? prev - prev / 8 + cost / 8 : cost);
+    }
+
+  if (acquire)
+    registry_release (rp);
+}
+
+/*
+ * Background reclaimer.
+ *
+ * When enabled, threads that reach their flush thresholds don't run the
+ * grace period themselves. Instead, they signal a library-owned thread that
+ * synchronizes the registry on their behalf, so that the cost of polling
+ * other threads and running finalizers is moved out of their way.
+ *
+ * The same thread also bounds how long deltas may stay in a table that is
+ * never flushed, for instance, by a thread that went quiet. When a maximum
+ * latency is set, it wakes up every half of it, and runs a grace period if
+ * any table was already pending on its previous tick.
+ */
+
+typedef struct
+{
+  xmutex_t lock;
+  xcond_t cv;
+  xthread_t thread;
+  int pending;
+  int running;
+  int async;
+  int initialized;
+  uint64_t latency;
+  uintptr_t tick;
+} SrefReclaimer;
+
+static SrefReclaimer reclaimer;
+
+/* Stamp the tables that have become pending since the last tick. Returns
+ * true if any of them was already pending on the previous one. */
+static int
+reclaimer_tick (SrefReclaimer *rp, SrefRegistry *regp)
+{
+  uintptr_t tick = ++rp->tick;
+  int ret = 0;
+
+  xmutex_lock (&regp->td_lock);
+  registry_foreach (regp, qp)
+    for (int i = 0; i < 2; ++i)
+      {
+        SrefCache *cache = &((SrefData *)qp)->cache[i];
+
+        /* The owner may be adding to it; a stale read only delays us. */
+        if (!xatomic_load_rlx (&cache->deltas.n_used) &&
+            !xatomic_load_rlx ((uintptr_t *)&cache->calls))
+          cache->tick = 0;
+        else if (!cache->tick)
+          cache->tick = tick;
+        else if (cache->tick != tick)
+          ret = 1;
+      }
+
+  /* Orphans were handed off when their thread exited, and nobody else may
+   * be around to run a grace period for them. Threads that registered since
+   * the last one aren't seen until a grace period adopts them. */
+  for (unsigned int i = 0; i < regp->n_nodes; ++i)
+    if (regp->nodes[i].orphans[0] || regp->nodes[i].orphans[1] ||
+        xatomic_load_rlx (&regp->nodes[i].pending))
+      ret = 1;
+
+  xmutex_unlock (&regp->td_lock);
+  return (ret);
+}
+
+static XTHREAD_RET
+reclaimer_run (void *arg)
+{
+  SrefReclaimer *rp = (SrefReclaimer *)arg;
+  uint64_t next = 0;
+
+  /* Register ourselves right away, so that finalizers that use the API
+   * don't attempt to do so while we hold the registry locks. */
+  sref_local ();
+  xmutex_lock (&rp->lock);
+
+  while (1)
+    {
+      uint64_t now = rp->latency ? xclock_ns () : 0;
+
+      if (rp->pending)
+        {
+          rp->pending = 0;
+          xmutex_unlock (&rp->lock);
+          registry_sync (1);
+          xmutex_lock (&rp->lock);
+        }
+      else if (!rp->running)
+        break;
+      else if (!rp->latency)
+        xcond_wait (&rp->cv, &rp->lock);
+      else if (now < next && next - now <= rp->latency / 2)
+        xcond_timedwait (&rp->cv, &rp->lock, next - now);
       else
-        sp->fini (sp);
+        {
+          next = now + rp->latency / 2;
+          xmutex_unlock (&rp->lock);
+          if (reclaimer_tick (rp, &registry))
+            registry_sync (1);
+
+          xmutex_lock (&rp->lock);
+        }
+    }
+
+  xmutex_unlock (&rp->lock);
+  return (0);
+}
+
+static int
+reclaimer_start (SrefReclaimer *rp)
+{
+  if (rp->running)
+    return (0);
+  else if (!rp->initialized)
+    {
+      if (xmutex_init (&rp->lock) < 0)
+        return (-1);
+      else if (xcond_init (&rp->cv) < 0)
+        {
+          xmutex_destroy (&rp->lock);
+          return (-1);
+        }
+
+      rp->initialized = 1;
+    }
+
+  rp->pending = 0;
+  rp->running = 1;
+  if (xthread_create (&rp->thread, reclaimer_run, rp) < 0)
+    {
+      rp->running = 0;
+      return (-1);
+    }
+
+  return (0);
+}
+
+static void
+reclaimer_stop (SrefReclaimer *rp)
+{
+  if (!rp->running)
+    return;
+
+  xmutex_lock (&rp->lock);
+  rp->running = 0;
+  xcond_signal (&rp->cv);
+  xmutex_unlock (&rp->lock);
+  xthread_join (rp->thread);
+}
+
+/* Enable or disable the features of the reclaimer, and start or stop its
+ * thread depending on whether any of them is left. */
+static int
+reclaimer_setup (SrefReclaimer *rp, int async, uint64_t latency)
+{
+  if (!async && !latency)
+    {
+      reclaimer_stop (rp);
+      rp->async = 0;
+      rp->latency = 0;
+      return (0);
+    }
+  else if (reclaimer_start (rp) < 0)
+    return (-1);
+
+  /* Wake it up so that a new latency takes effect right away. */
+  xmutex_lock (&rp->lock);
+  xatomic_store_rel (&rp->async, async);
+  rp->latency = latency;
+  xcond_signal (&rp->cv);
+  xmutex_unlock (&rp->lock);
+  return (0);
+}
+
+/* Ask the reclaimer to run a grace period. Returns 0 if flushes aren't
+ * handed off to it. */
+static int
+reclaimer_signal (SrefReclaimer *rp)
+{
+  if (!xatomic_load_rlx (&rp->async))
+    return (0);
+
+  xmutex_lock (&rp->lock);
+  int ret = rp->running && rp->async;
+  if (ret && !rp->pending)
+    {
+      rp->pending = 1;
+      xcond_signal (&rp->cv);
+    }
+
+  xmutex_unlock (&rp->lock);
+  return (ret);
+}
+
+/* Bump the nesting level in the counter of a thread, whose current value
+ * is VALUE, and order it before any later loads. */
+static inline void
+local_enter (SrefData *self, uintptr_t value)
+{
+  uintptr_t nval = value + (1 << GP_PHASE_BIT);
+  assert (nval > value);
+  xatomic_store_rel (&self->pub->counter, nval);
+  xatomic_mfence_rd ();
+}
+
+/* Set the counter of a thread back to VALUE, and if that makes it leave its
+ * outermost critical section, wake up a grace period waiting on it. */
+static inline void
+local_leave (SrefData *self, uintptr_t value)
+{
+  xatomic_store_rel (&self->pub->counter, value);
+  if (!(value >> GP_PHASE_BIT) && xatomic_load_rlx_int (&registry.waiting) &&
+      xatomic_swap (&registry.waiting, 0))
+    /* A grace period is waiting on readers - Let it know we're done. */
+    xfutex_wake (&registry.waiting);
+}
 
-      sp = next;
-    }
+/* A thread outside a critical section is considered quiescent, and so a
+ * grace period may be applying the very table it's adding to. Operations
+ * that touch the tables are thus made from inside one, which is entered
+ * without resetting the flush triggers, as it isn't the caller's. Callers
+ * must pick the table to use only after this, so that a grace period that
+ * flips the phase in between either waits for them or has them use the
+ * next table. Returns the value of the counter to restore once done. */
+static inline uintptr_t
+local_pin (SrefData *self)
+{
+  uintptr_t value = local_counter (self);
+  if (!(value >> GP_PHASE_BIT))
+    local_enter (self, registry_counter ());
 
-  rp->review = NULL;
-  if (acquire)
-    registry_unlock (rp);
+  return (value);
+}
+
+static inline void
+local_unpin (SrefData *self, uintptr_t value)
+{
+  if (!(value >> GP_PHASE_BIT))
+    local_leave (self, value);
 }
 
 void sref_read_enter (void)
@@ -413,26 +2047,74 @@ void sref_read_enter (void)
   SrefData *self = sref_local ();
   uintptr_t value = local_counter (self);
   if (!(value >> GP_PHASE_BIT))
-    { /* A grace period has elapsed, so we can reset the 'flush' flag. */
+    { /* A grace period has elapsed, so we can reset the 'flush' flag,
+       * unless the table is still at its limit, as a thread that keeps
+       * alternating between reading and adding would overflow it. */
       value = registry_counter ();
-      self->cache[value & GP_PHASE_BIT].flush = 0;
-      self->n_ops = 0;
+      SrefCache *cache = &self->cache[value & GP_PHASE_BIT];
+      cache->flush = xatomic_load_rlx (&cache->deltas.n_used) >=
+                     cache->deltas.limit;
+      self->pub->n_ops = 0;
     }
 
-  uintptr_t nval = value + (1 << GP_PHASE_BIT);
-  assert (nval > value);
-  xatomic_store_rel (&self->counter, nval);
+  local_enter (self, value);
+}
+
+/* Move the flush trigger of a thread towards the number of operations that
+ * pays for the recent cost of a grace period, within the configured bounds.
+ * Expensive grace periods mean batching more work, while cheap ones mean
+ * deferred memory can be released sooner. */
+static void
+sref_adapt (SrefData *self, const SrefTable *tp)
+{
+  uintptr_t hi = xatomic_load_rlx (&lib_config.adapt_max);
+  if (!hi || self->fixed_ops)
+    return;
+
+  uintptr_t lo = xatomic_load_rlx (&lib_config.adapt_min);
+  uintptr_t target = xatomic_load_rlx (&registry.gp_cost) /
+                     SREF_ADAPT_NS_PER_OP;
+
+  /* If the table filled up before the trigger was reached, a higher
+   * trigger wouldn't batch any more work. */
+  if (tp->n_used >= tp->limit && target > self->pub->n_ops)
+    target = self->pub->n_ops;
+
+  if (!lo)
+    lo = 1;
+  else if (lo > hi)
+    lo = hi;
+
+  /* Move halfway each time, so that a single outlier can't swing it. */
+  target = (self->pub->max_ops + target) / 2;
+  self->pub->max_ops = target < lo ? lo : (target > hi ? hi : target);
 }
 
+#define FLUSH_SYNC       0
+#define FLUSH_ASYNC      1
+#define FLUSH_EXPLICIT   2
+
+/* Flush the deltas for every thread. Returns -1 if we are inside a critical
+ * section, 1 if the work was handed to the reclaimer, and 0 otherwise. */
 static int
-sref_flush_impl (SrefData *self, uintptr_t value)
+sref_flush_impl (SrefData *self, uintptr_t value, int mode)
 {
   if (value >> GP_PHASE_BIT)
     /* We are currently in a critical section, and can't flush our deltas. */
     return (-1);
 
+  sref_adapt (self, &self->cache[value & GP_PHASE_BIT].deltas);
   self->cache[value & GP_PHASE_BIT].flush = 0;
-  self->n_ops = 0;
+  self->pub->n_ops = 0;
+
+  if (mode == FLUSH_EXPLICIT)
+    SREF_STAT_INC (n_flush_explicit);
+  else
+    SREF_STAT_INC (n_flush_auto);
+
+  if (mode == FLUSH_ASYNC && reclaimer_signal (&reclaimer))
+    return (1);
+
   registry_sync (1);
   return (0);
 }
@@ -444,69 +2126,228 @@ void sref_read_exit (void)
 
   assert (value >= (1 << GP_PHASE_BIT));
   value -= 1 << GP_PHASE_BIT;
-  xatomic_store_rel (&self->counter, value);
+  local_leave (self, value);
 
   if (self->cache[value & GP_PHASE_BIT].flush)
-    sref_flush_impl (self, value);
+    sref_flush_impl (self, value, FLUSH_ASYNC);
 }
 
 static void
-sref_update_nops (SrefData *self, SrefCache *cache)
+sref_update_nops (SrefData *self, SrefCache *cache, size_t n)
 {
-  if (++self->n_ops >= SREF_NMAXOPS && cache->flush < 2)
+  self->pub->n_ops += n;
+  if (self->pub->n_ops >= self->pub->max_ops && cache->flush < 2)
     ++cache->flush;
 }
 
+/* Apply deltas directly, and add the objects to the review list. We use the
+ * thread registry lock to act as a serialization barrier. */
+static void
+registry_review (SrefRegistry *rp, void **ptrs, size_t n, intptr_t delta)
+{
+  SREF_STAT_ADD (n_review, n);
+  xmutex_lock (&rp->td_lock);
+  for (size_t i = 0; i < n; ++i)
+    {
+      Sref *sp = (Sref *)ptrs[i];
+      xtrace2 (review__insert, sp, delta);
+      sp->refcnt += delta;
+      if (!sp->next)
+        {
+          sp->next = rp->review;
+          rp->review = sp;
+        }
+    }
+
+  xmutex_unlock (&rp->td_lock);
+}
+
 static void
-sref_acq_rel (void *refptr, intptr_t delta, size_t off)
+sref_acq_rel (void *refptr, intptr_t delta)
 {
   assert (refptr);
   SrefData *self = sref_local ();
+  uintptr_t value = local_pin (self);
   uintptr_t idx = registry_counter () & GP_PHASE_BIT;
   SrefCache *cache = &self->cache[idx];
-  SrefTable *tp = (SrefTable *)((char *)cache + off);
-
-  sref_update_nops (self, cache);
-  cache->flush += sref_add (tp, refptr, delta, &idx);
-  if (cache->flush > 1 && sref_flush_impl (self, local_counter (self)) < 0)
-    { /* This is an emergency situation. Our cache is full, and we are inside
-       * a read-side critical section, and thus can't flush deltas. So we have
-       * to resort to adding this sref pointer to the review list. We use the
-       * thread registry lock to act as a serialization barrier. */
-
-      Sref *sp = (Sref *)refptr;
-      assert (sp == tp->deltas[idx].ptr);
-      tp->deltas[idx].ptr = NULL;
-      tp->deltas[idx].delta = 0;
+  SrefTable *tp = &cache->deltas;
+
+  sref_update_nops (self, cache, 1);
+  int rv = sref_add (tp, refptr, delta, &idx);
+  cache->flush += rv;
+  local_unpin (self, value);
+
+  if (cache->flush < 2)
+    return;
+
+  int ret = sref_flush_impl (self, value, FLUSH_ASYNC);
+
+  /* Note that only new entries can make the table fill up, so it's safe to
+   * remove the one we just inserted below. */
+  if (!rv)
+    return;
+  else if (ret > 0)
+    {
+      if (tp->n_used * 8 >= tp->n_max * 7)
+        /* The reclaimer can't keep up with us. Since we're outside a
+         * critical section, we can apply backpressure by flushing on
+         * our own. */
+        sref_flush_impl (self, value, FLUSH_SYNC);
+    }
+  /* If we can't flush because we are inside a read-side critical section,
+   * make room in the table for further deltas instead. */
+  else if (ret < 0 && sref_table_full_p (tp) &&
+           sref_local_grow (self, tp) < 0)
+    { /* This is an emergency situation. Our cache is full, we are inside
+       * a read-side critical section, and we couldn't grow the table. So we
+       * have to resort to adding this sref pointer to the review list. */
+      assert (refptr == tp->keys[idx]);
+      tp->keys[idx] = NULL;
+      tp->vals[idx] = 0;
       --tp->n_used;
 
-      xmutex_lock (&registry.td_lock);
-      sp->refcnt += delta;
-      if (!sp->next)
-        {
-          sp->next = registry.review;
-          registry.review = sp;
+      registry_review (&registry, &refptr, 1, delta);
+    }
+}
+
+static void
+sref_acq_rel_n (void **ptrs, size_t n, intptr_t delta)
+{
+  SrefData *self = sref_local ();
+  uintptr_t value = local_counter (self);
+  SrefCache *cache = &self->cache[registry_counter () & GP_PHASE_BIT];
+  SrefTable *tp = &cache->deltas;
+
+  /* Make room for the whole batch before inserting anything, so that
+   * we only have to deal with a full table once. */
+  if (!(value >> GP_PHASE_BIT) && !sref_table_fits_p (tp, n))
+    {
+      if (n > 1 && n * 100 >= (size_t)tp->n_max * tp->load)
+        { /* Even an empty table is too small. Split the batch. */
+          sref_acq_rel_n (ptrs, n / 2, delta);
+          sref_acq_rel_n (ptrs + n / 2, n - n / 2, delta);
+          return;
         }
-      xmutex_unlock (&registry.td_lock);
+
+      sref_flush_impl (self, value, FLUSH_SYNC);
+    }
+
+  local_pin (self);
+  cache = &self->cache[registry_counter () & GP_PHASE_BIT];
+  tp = &cache->deltas;
+
+  /* If the phase moved on in the meantime, or we are inside a critical
+   * section, the table may still be short on room. */
+  while (!sref_table_fits_p (tp, n) && sref_local_grow (self, tp) == 0)
+    ;
+
+  if (!sref_table_fits_p (tp, n))
+    { /* Same as in 'sref_acq_rel', but for the whole batch. */
+      registry_review (&registry, ptrs, n, delta);
+      sref_update_nops (self, cache, n);
+      local_unpin (self, value);
+      return;
     }
+
+  for (size_t i = 0; i < n; ++i)
+    {
+      assert (ptrs[i]);
+      xprefetch (tp->keys + sref_hash (tp, ptrs[i]));
+    }
+
+  int rv = 0;
+  uintptr_t idx;
+
+  for (size_t i = 0; i < n; ++i)
+    rv |= sref_add (tp, ptrs[i], delta, &idx);
+
+  sref_update_nops (self, cache, n);
+  cache->flush += rv;
+  local_unpin (self, value);
+
+  if (cache->flush > 1)
+    sref_flush_impl (self, value, FLUSH_ASYNC);
+}
+
+int sref_call (void *ptr, void (*cb) (void *))
+{
+  assert (cb);
+  SrefData *self = sref_local ();
+  uintptr_t value = local_pin (self);
+  SrefCache *cache = &self->cache[registry_counter () & GP_PHASE_BIT];
+  int ret = sref_calls_add (&cache->calls, ptr, cb);
+
+  if (ret == 0)
+    sref_update_nops (self, cache, 1);
+
+  local_unpin (self, value);
+  if (ret == 0 && cache->flush > 1)
+    sref_flush_impl (self, value, FLUSH_ASYNC);
+
+  return (ret);
 }
 
 void* sref_acquire (void *refptr)
 {
-  sref_acq_rel (refptr, +1, offsetof (SrefCache, refs));
+  sref_acq_rel (refptr, +1);
   return (refptr);
 }
 
 void sref_release (void *refptr)
 {
-  sref_acq_rel (refptr, -1, offsetof (SrefCache, unrefs));
+  sref_acq_rel (refptr, -1);
+}
+
+void sref_publish (void *slot, void *ptr)
+{
+  xatomic_store_rel ((uintptr_t *)slot, (uintptr_t)ptr);
+}
+
+/* Compilers implement consume ordering as acquire, which costs nothing
+ * over a plain load on strongly ordered architectures. */
+void* sref_deref (const void *slot)
+{
+  return ((void *)xatomic_load_acq ((uintptr_t *)slot));
+}
+
+/* The slot takes over the caller's reference to the new pointer, and the
+ * one it had to the old pointer is released. The latter remains valid until
+ * the end of the critical section, if the caller is in one. */
+void* sref_swap (void *slot, void *ptr)
+{
+  void *ret = (void *)xatomic_swap_ptr ((uintptr_t *)slot, (uintptr_t)ptr);
+  if (ret)
+    sref_acq_rel (ret, -1);
+
+  return (ret);
+}
+
+int sref_cas (void *slot, void *exp, void *nval)
+{
+  if (xatomic_cas ((uintptr_t *)slot, (uintptr_t)exp,
+                   (uintptr_t)nval) != (uintptr_t)exp)
+    return (-1);
+  else if (exp)
+    sref_acq_rel (exp, -1);
+
+  return (0);
+}
+
+void sref_acquire_n (void **ptrs, size_t n)
+{
+  sref_acq_rel_n (ptrs, n, +1);
+}
+
+void sref_release_n (void **ptrs, size_t n)
+{
+  sref_acq_rel_n (ptrs, n, -1);
 }
 
 int sref_flush (void)
 {
   SrefData *self = sref_local ();
   uintptr_t value = local_counter (self);
-  int ret = sref_flush_impl (self, value);
+  int ret = sref_flush_impl (self, value, FLUSH_EXPLICIT);
 
   if (ret < 0)
     /* If we didn't manage to flush, set the flag to do it ASAP. */
@@ -527,41 +2368,154 @@ sref_data_fini (XKEY_ARG (void *ptr))
   if (!dlist_linked_p (&self->link))
     return;
 
-  xatomic_store_rel (&self->counter, 0);
-  registry_lock (&registry);
+  self->pub->ready = 0;
+  xatomic_store_rel (&self->pub->counter, 0);
 
-  uintptr_t idx = registry_counter () & GP_PHASE_BIT;
   SrefCache *cache = self->cache;
+  SrefOrphan *orphans[2] = { NULL, NULL };
+  int wait = 0;
 
-  sref_merge (&cache[idx].refs, &cache[idx ^ GP_PHASE_BIT].refs);
-  sref_merge (&cache[idx].unrefs, &cache[idx ^ GP_PHASE_BIT].unrefs);
+  for (int i = 0; i < 2; ++i)
+    if (sref_cache_pending_p (&cache[i]) &&
+        !(orphans[i] = (SrefOrphan *)malloc (sizeof (*orphans[i]))))
+      wait = 1;
 
-  if (cache[idx].refs.n_used || cache[idx].unrefs.n_used)
-    registry_sync (0);
+  if (wait)
+    { /* Out of memory: Wait for the grace periods ourselves. */
+      free (orphans[0]);
+      free (orphans[1]);
+      registry_lock (&registry);
 
-  idx ^= GP_PHASE_BIT;
-  if (cache[idx].refs.n_used || cache[idx].unrefs.n_used)
-    registry_sync (0);
+      uintptr_t idx = registry_counter () & GP_PHASE_BIT;
+      sref_merge (&cache[idx].deltas, &cache[idx ^ GP_PHASE_BIT].deltas);
 
-  dlist_del (&self->link);
-  registry_unlock (&registry);
+      if (sref_cache_pending_p (&cache[idx]))
+        registry_sync (0);
+
+      idx ^= GP_PHASE_BIT;
+      if (sref_cache_pending_p (&cache[idx]))
+        registry_sync (0);
+    }
+  else
+    {
+      xmutex_lock (&registry.td_lock);
+
+      /* Our tables are left for the next phase flip: Every reader that may
+       * still see the objects in them is waited for by then. Grace periods
+       * only apply tables with this lock held, so none is using ours, and
+       * one that flips the phase after we read it will take our orphans. */
+      SrefNode *np = &registry.nodes[self->node];
+      uintptr_t idx = registry_counter () & GP_PHASE_BIT;
+
+      for (int i = 0; i < 2; ++i)
+        if (orphans[i])
+          {
+            sref_cache_move (&orphans[i]->cache, &cache[i]);
+            orphans[i]->next = np->orphans[idx];
+            np->orphans[idx] = orphans[i];
+          }
+    }
+
+  if (dlist_empty_p (&self->link))
+    /* No grace period has adopted us yet. */
+    registry_unpend (&registry.nodes[self->node], self);
+  else
+    dlist_del (&self->link);
+
+#ifdef SREF_STATS
+  sref_stats_add (&registry.retired, self->stats);
+  memset (self->stats, 0, sizeof (*self->stats));
+#endif
+
+  if (wait)
+    registry_release (&registry);
+  else
+    xmutex_unlock (&registry.td_lock);
+
+  for (int i = 0; i < 2; ++i)
+    {
+      sref_table_fini (&cache[i].deltas);
+      sref_calls_fini (&cache[i].calls);
+    }
 }
 
 static void
 sref_atexit (void)
 {
   sref_data_fini (XKEY_ARG (&local_data));   /* avoid sref_local. */
+
+  /* Nobody may be left to run the grace periods for the orphans. */
+  registry_lock (&registry);
+  for (int i = 0; i < 2; ++i)
+    registry_sync (0);
+
+  registry_release (&registry);
+
+  /* Wait for the pool to run whatever it was handed. */
+  finalizers_stop (&finalizers);
 }
 
 static int sref_initialized;
 
+/* Set up the sub-registries, for as many nodes as there are, or as many as
+ * SREF_NUMA_NODES says for a simulated topology. */
+static void
+registry_topology (SrefRegistry *rp)
+{
+  const char *env = getenv ("SREF_NUMA_NODES");
+  unsigned long n = 0;
+
+  if (env && (n = strtoul (env, NULL, 10)) > 0)
+    rp->simulated = 1;
+  else
+    n = xnuma_count ();
+
+  rp->n_nodes = n < SREF_MAX_NODES ? (unsigned int)n : SREF_MAX_NODES;
+  for (unsigned int i = 0; i < rp->n_nodes; ++i)
+    dlist_init_head (&rp->nodes[i].root);
+}
+
+static const struct
+{
+  const char *name;
+  int param;
+} config_envs[] =
+{
+  { "SREF_CAPACITY", SREF_CONFIG_CAPACITY },
+  { "SREF_LOAD_FACTOR", SREF_CONFIG_LOAD },
+  { "SREF_MAX_OPS", SREF_CONFIG_MAX_OPS },
+  { "SREF_HELPERS", SREF_CONFIG_HELPERS },
+  { "SREF_ADAPT_MIN", SREF_CONFIG_ADAPT_MIN },
+  { "SREF_ADAPT_MAX", SREF_CONFIG_ADAPT_MAX },
+  { "SREF_FINALIZERS", SREF_CONFIG_FINALIZERS }
+};
+
+/* Read the library settings from the environment. Invalid values are
+ * ignored, since there's nobody to report them to. */
+static void
+sref_config_env (void)
+{
+  for (size_t i = 0; i < sizeof (config_envs) / sizeof (config_envs[0]); ++i)
+    {
+      const char *env = getenv (config_envs[i].name);
+      char *end;
+
+      if (!env || !*env)
+        continue;
+
+      unsigned long val = strtoul (env, &end, 10);
+      if (!*end)
+        (void)sref_lib_config (config_envs[i].param, val);
+    }
+}
+
 int sref_lib_init (void)
 {
   if (sref_initialized)
     return (0);
   else if (xkey_create (&reg_key, sref_data_fini) < 0)
     return (-1);
-  else if (xmutex_init (&registry.td_lock) < 0)
+  else if (xmembarrier_init () < 0 || xmutex_init (&registry.td_lock) < 0)
     {
       xkey_delete (reg_key);
       return (-1);
@@ -580,32 +2534,259 @@ int sref_lib_init (void)
       return (-1);
     }
 
-  dlist_init_head (&registry.root);
+  registry.review = SREF_LIST_END;
+  registry.dead = (uintptr_t)SREF_LIST_END;
+  registry_topology (&registry);
+  sref_config_env ();
   sref_initialized = 1;
   return (0);
 }
 
+int sref_lib_init_ex (unsigned int flags)
+{
+  if (sref_lib_init () < 0)
+    return (-1);
+
+  if (reclaimer_setup (&reclaimer, (flags & SREF_LIB_RECLAIMER) != 0,
+                       reclaimer.latency) < 0)
+    return (-1);
+
+  if (!(flags & (SREF_LIB_PARALLEL | SREF_LIB_NUMA)))
+    helpers_stop (&helpers);
+  else if (helpers_start (&helpers, (flags & SREF_LIB_NUMA) != 0) < 0)
+    return (-1);
+
+  if (!(flags & SREF_LIB_FINALIZERS))
+    finalizers_stop (&finalizers);
+  else if (finalizers_start (&finalizers) < 0)
+    return (-1);
+
+  return (0);
+}
+
+int sref_set_max_latency (unsigned int mlsec)
+{
+  if (!sref_initialized)
+    return (-1);
+
+  return (reclaimer_setup (&reclaimer, reclaimer.async,
+                           (uint64_t)mlsec * 1000000));
+}
+
+static int
+sref_config_check (int param, uintptr_t value)
+{
+  switch (param)
+    {
+      case SREF_CONFIG_CAPACITY:
+        return (value >= XGROUP_SIZE && value <= CONFIG_MAX_CAPACITY &&
+                !(value & (value - 1)) ? 0 : -1);
+
+      case SREF_CONFIG_LOAD:
+        return (value >= CONFIG_MIN_LOAD &&
+                value <= CONFIG_MAX_LOAD ? 0 : -1);
+
+      case SREF_CONFIG_MAX_OPS:
+        return (value ? 0 : -1);
+
+      case SREF_CONFIG_HELPERS:
+        return (value <= SREF_MAX_HELPERS ? 0 : -1);
+
+      case SREF_CONFIG_ADAPT_MIN:
+      case SREF_CONFIG_ADAPT_MAX:
+        return (0);
+
+      case SREF_CONFIG_FINALIZERS:
+        return (value && value <= SREF_MAX_HELPERS ? 0 : -1);
+
+      default:
+        return (-1);
+    }
+}
+
+int sref_lib_config (int param, uintptr_t value)
+{
+  if (sref_config_check (param, value) < 0)
+    return (-1);
+
+  switch (param)
+    {
+      case SREF_CONFIG_CAPACITY:
+        lib_config.capacity = (unsigned int)value;
+        break;
+
+      case SREF_CONFIG_LOAD:
+        lib_config.load = (unsigned int)value;
+        break;
+
+      case SREF_CONFIG_MAX_OPS:
+        lib_config.max_ops = value;
+        break;
+
+      case SREF_CONFIG_HELPERS:
+        lib_config.helpers = (unsigned int)value;
+        break;
+
+      /* These are read by running threads when they flush. */
+      case SREF_CONFIG_ADAPT_MIN:
+        xatomic_store_rel (&lib_config.adapt_min, value);
+        break;
+
+      case SREF_CONFIG_ADAPT_MAX:
+        xatomic_store_rel (&lib_config.adapt_max, value);
+        break;
+
+      case SREF_CONFIG_FINALIZERS:
+        lib_config.finalizers = (unsigned int)value;
+        break;
+    }
+
+  return (0);
+}
+
+int sref_thread_config (int param, uintptr_t value)
+{
+  uintptr_t dfl;
+
+  switch (param)
+    {
+      case SREF_CONFIG_CAPACITY:
+        dfl = lib_config.capacity;
+        break;
+
+      case SREF_CONFIG_LOAD:
+        dfl = lib_config.load;
+        break;
+
+      case SREF_CONFIG_MAX_OPS:
+        dfl = lib_config.max_ops;
+        break;
+
+      default:
+        /* The rest only make sense for the library as a whole. */
+        return (-1);
+    }
+
+  if (value && sref_config_check (param, value) < 0)
+    return (-1);
+
+  SrefData *self = sref_local ();
+  if (param == SREF_CONFIG_MAX_OPS)
+    {
+      /* An explicit trigger opts the thread out of adapting it. */
+      self->fixed_ops = value != 0;
+      self->pub->max_ops = value ? value : dfl;
+      return (0);
+    }
+  else if (!value)
+    /* Go back to the library settings. */
+    value = dfl;
+
+  if (param == SREF_CONFIG_LOAD)
+    {
+      for (int i = 0; i < 2; ++i)
+        sref_table_set_load (&self->cache[i].deltas,
+                             self->capacity, (unsigned int)value);
+
+      sref_local_publish (self);
+      return (0);
+    }
+
+  /* Resizing the tables needs them to be empty, which means flushing. */
+  if (sref_cache_pending_p (&self->cache[0]) ||
+      sref_cache_pending_p (&self->cache[1]))
+    {
+      if (sref_flush () < 0 ||
+          self->cache[0].deltas.n_used || self->cache[1].deltas.n_used)
+        return (-1);
+    }
+
+  /* Grace periods go through every slot of our tables, whether or not they
+   * are empty, so keep them out while the tables are swapped. */
+  int ret = 0;
+  xmutex_lock (&registry.td_lock);
+  for (int i = 0; i < 2; ++i)
+    {
+      SrefTable *tp = &self->cache[i].deltas;
+      unsigned int load = tp->load;
+
+      sref_table_fini (tp);
+      if (sref_table_setup (tp, (unsigned int)value, load) < 0)
+        {
+          sref_table_set_load (tp, SREF_NDELTAS, load);
+          ret = -1;
+        }
+    }
+
+  self->capacity = self->cache[0].deltas.n_max;
+  sref_local_publish (self);
+  xmutex_unlock (&registry.td_lock);
+  return (ret);
+}
+
 static void
 sref_atfork_prepare (void)
 {
   registry_lock (&registry);
+  if (helpers.initialized)
+    xmutex_lock (&helpers.lock);
+  if (reclaimer.initialized)
+    xmutex_lock (&reclaimer.lock);
+  if (finalizers.initialized)
+    xmutex_lock (&finalizers.lock);
 }
 
 static void
 sref_atfork_parent (void)
 {
+  if (finalizers.initialized)
+    xmutex_unlock (&finalizers.lock);
+  if (reclaimer.initialized)
+    xmutex_unlock (&reclaimer.lock);
+  if (helpers.initialized)
+    xmutex_unlock (&helpers.lock);
+
   registry_unlock (&registry);
 }
 
 static void
 sref_atfork_child (void)
 {
+  if (reclaimer.initialized)
+    { /* The reclaimer thread doesn't exist in the child. */
+      reclaimer.running = 0;
+      reclaimer.pending = 0;
+      reclaimer.async = 0;
+      reclaimer.latency = 0;
+      xmutex_unlock (&reclaimer.lock);
+    }
+
+  if (finalizers.initialized)
+    { /* Neither do the finalizer threads. */
+      finalizers.running = 0;
+      finalizers.n_threads = 0;
+      xmutex_unlock (&finalizers.lock);
+    }
+
+  if (helpers.initialized)
+    { /* Nor the helpers, so deltas are applied serially from now on. */
+      helpers.running = 0;
+      helpers.n_threads = 0;
+      helpers.n_ready = 0;
+      helpers.n_pending = 0;
+      xmutex_unlock (&helpers.lock);
+    }
+
   registry_unlock (&registry);
-  dlist_init_head (&registry.root);
+  for (unsigned int i = 0; i < registry.n_nodes; ++i)
+    {
+      dlist_init_head (&registry.nodes[i].root);
+      registry.nodes[i].pending = 0;
+    }
 
   SrefData *self = &local_data;
   if (dlist_linked_p (&self->link))
-    dlist_add (&registry.root, &self->link);
+    dlist_add (&registry.nodes[self->node].root, &self->link);
 }
 
 SrefAtFork sref_atfork (void)
@@ -617,6 +2798,46 @@ SrefAtFork sref_atfork (void)
   return (ret);
 }
 
+int sref_stats_get (SrefStats *outp)
+{
+#ifdef SREF_STATS
+  SrefRegistry *rp = &registry;
+  memset (outp, 0, sizeof (*outp));
+
+  /* A grace period moves threads off the registry while it polls them, so
+   * wait for it to put them back. Exiting threads fold their statistics
+   * into the retired ones as they leave, with the thread registry lock
+   * held, so every thread is counted exactly once, and totals never drop. */
+  registry_lock (rp);
+  sref_stats_add (outp, &rp->retired);
+  registry_foreach (rp, qp)
+    sref_stats_add (outp, ((SrefData *)qp)->stats);
+
+  /* Threads that are yet to be adopted can only leave with the lock held. */
+  for (unsigned int i = 0; i < rp->n_nodes; ++i)
+    for (SrefData *dp = (SrefData *)xatomic_load_acq (&rp->nodes[i].pending);
+         dp; dp = dp->next_pending)
+      sref_stats_add (outp, dp->stats);
+  registry_unlock (rp);
+
+  return (0);
+#else
+  (void)outp;
+  return (-1);
+#endif
+}
+
+int sref_stats_local (SrefStats *outp)
+{
+#ifdef SREF_STATS
+  *outp = local_stats;
+  return (0);
+#else
+  (void)outp;
+  return (-1);
+#endif
+}
+
 void sref_lib_version (int *major, int *minor)
 {
   *major = MAJOR;
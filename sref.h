@@ -18,6 +18,7 @@
 #ifndef SREF_H_
 #define SREF_H_   1
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -38,9 +39,83 @@ typedef struct
   void (*child) (void);
 } SrefAtFork;
 
+/* Number of buckets in the probe length histogram. */
+#define SREF_STATS_NPROBES   8
+
+typedef struct
+{
+  uint64_t n_gps;              /* Grace periods run. */
+  uint64_t n_deltas;           /* Deltas applied to reference counts. */
+  uint64_t n_fini;             /* Finalizers called. */
+  uint64_t n_review;           /* Fallbacks to the review list. */
+  uint64_t n_flush_auto;       /* Flushes triggered by a threshold. */
+  uint64_t n_flush_explicit;   /* Calls to 'sref_flush' that flushed. */
+  uint64_t probes[SREF_STATS_NPROBES];   /* Probe lengths, by power of 2. */
+  uint64_t poll_ns;            /* Time spent waiting for readers. */
+  uint64_t sync_ns;            /* Time spent running grace periods. */
+} SrefStats;
+
+/* Per-thread state, as seen by the inline fast paths (see SREF_INLINE below).
+ * The layout of this structure is part of the ABI, and so any change to it
+ * must also change SREF_LOCAL_VERSION, which is part of the symbol name (see
+ * SREF_LOCAL below). */
+typedef struct
+{
+  uintptr_t counter;               /* Nesting depth << 1 | phase. */
+  uintptr_t n_ops;                 /* Operations since the last flush. */
+  uintptr_t max_ops;               /* Operations that trigger a flush. */
+  const uintptr_t *gp_counter;     /* Global phase. */
+  const unsigned int *gp_waiting;  /* Set if a grace period is waiting. */
+  struct
+    {
+      void **keys;
+      intptr_t *vals;
+      unsigned int *n_used;
+      int *flush;
+      uintptr_t mask;              /* Mask for the first slot of a group. */
+      unsigned int limit;          /* Slots in use that trigger a flush. */
+    } tables[2];                   /* Delta tables, indexed by phase. */
+  int light_fence;                 /* Readers only need compiler barriers. */
+  int ready;                       /* The fast paths may be used. */
+} SrefLocal;
+
+#define SREF_LOCAL_VERSION   2
+
+/* The name under which the library exports it ('sref_local_v2'). */
+#define SREF_LOCAL_NAME_(v)   sref_local_v ## v
+#define SREF_LOCAL_NAME(v)    SREF_LOCAL_NAME_ (v)
+#define SREF_LOCAL   SREF_LOCAL_NAME (SREF_LOCAL_VERSION)
+
+/* Flags for 'sref_lib_init_ex'. */
+#define SREF_LIB_RECLAIMER   0x1   /* Flush from a background thread. */
+#define SREF_LIB_PARALLEL    0x2   /* Apply deltas with helper threads. */
+#define SREF_LIB_NUMA        0x4   /* Likewise, on the node of each object. */
+#define SREF_LIB_FINALIZERS  0x8   /* Run finalizers on a thread pool. */
+
 /* Initialize the Sref library. */
 extern int sref_lib_init (void);
 
+/* Initialize the Sref library, enabling the features set in FLAGS. */
+extern int sref_lib_init_ex (unsigned int flags);
+
+/* Bound the time that deltas may wait before being flushed, in ms. */
+extern int sref_set_max_latency (unsigned int mlsec);
+
+/* Parameters for 'sref_lib_config' and 'sref_thread_config'. */
+#define SREF_CONFIG_CAPACITY   1   /* Slots in a table of deltas. */
+#define SREF_CONFIG_LOAD       2   /* Load that triggers a flush, in %. */
+#define SREF_CONFIG_MAX_OPS    3   /* Operations that trigger a flush. */
+#define SREF_CONFIG_HELPERS    4   /* Number of helper threads. */
+#define SREF_CONFIG_ADAPT_MIN  5   /* Lower bound for an adaptive trigger. */
+#define SREF_CONFIG_ADAPT_MAX  6   /* Upper bound; 0 disables adapting. */
+#define SREF_CONFIG_FINALIZERS 7   /* Number of finalizer threads. */
+
+/* Set a library-wide parameter, for threads that register afterwards. */
+extern int sref_lib_config (int param, uintptr_t value);
+
+/* Set a parameter for the calling thread only. */
+extern int sref_thread_config (int param, uintptr_t value);
+
 /* Fetch the library version. */
 extern void sref_lib_version (int *major, int *minor);
 
@@ -73,15 +148,174 @@ extern void* sref_acquire (void *refptr);
 /* Release an Sref, decrementing its local reference count. */
 extern void sref_release (void *refptr);
 
+/* Store PTR in the pointer at SLOT, so that readers see it initialized. */
+extern void sref_publish (void *slot, void *ptr);
+
+/* Load the pointer at SLOT, ordered against the initialization of what
+ * it points to. */
+extern void* sref_deref (const void *slot);
+
+/* Store PTR in the pointer at SLOT, and release the previous one. */
+extern void* sref_swap (void *slot, void *ptr);
+
+/* Replace the pointer at SLOT with NVAL if it's EXP, and release EXP. */
+extern int sref_cas (void *slot, void *exp, void *nval);
+
+/* Acquire N Srefs at once. */
+extern void sref_acquire_n (void **ptrs, size_t n);
+
+/* Release N Srefs at once. */
+extern void sref_release_n (void **ptrs, size_t n);
+
+/* Call CB with PTR as its argument once a grace period has elapsed. */
+extern int sref_call (void *ptr, void (*cb) (void *));
+
 /* Exit a critical section. */
 extern void sref_read_exit (void);
 
 /* Flush the accumulated references for all threads. */
 extern int sref_flush (void);
 
+/* Get the statistics for the whole process. */
+extern int sref_stats_get (SrefStats *outp);
+
+/* Get the statistics for the calling thread. */
+extern int sref_stats_local (SrefStats *outp);
+
 /* Get the 'pthread_atfork' callbacks for Sref. */
 extern SrefAtFork sref_atfork (void);
 
+#if defined (__GNUC__) || defined (__clang__)
+
+extern __thread SrefLocal SREF_LOCAL;
+
+/* Defining SREF_INLINE before including this header makes the calls below
+ * expand to inline code that handles the common cases by itself, and only
+ * calls into the library when a table is full, a flush is due, or the
+ * calling thread has yet to use the library. */
+#  ifdef SREF_INLINE
+
+static inline void
+sref_read_enter_inline (void)
+{
+  SrefLocal *lp = &SREF_LOCAL;
+  uintptr_t value = lp->counter;
+
+  if (__builtin_expect (!lp->ready, 0))
+    {
+      sref_read_enter ();
+      return;
+    }
+  else if (value >> 1)
+    { /* Nested critical section - The grace period side already knows
+       * we are active, so there's nothing to order. */
+      __atomic_store_n (&lp->counter, value + 2, __ATOMIC_RELEASE);
+      return;
+    }
+
+  value = __atomic_load_n (lp->gp_counter, __ATOMIC_RELAXED);
+  *lp->tables[value & 1].flush =
+    __atomic_load_n (lp->tables[value & 1].n_used, __ATOMIC_RELAXED) >=
+    lp->tables[value & 1].limit;
+  lp->n_ops = 0;
+  __atomic_store_n (&lp->counter, value + 2, __ATOMIC_RELEASE);
+
+  if (lp->light_fence)
+    __atomic_signal_fence (__ATOMIC_SEQ_CST);
+  else
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+}
+
+static inline void
+sref_read_exit_inline (void)
+{
+  SrefLocal *lp = &SREF_LOCAL;
+  uintptr_t value = lp->counter - 2;
+
+  /* Waking up a grace period, or flushing, is left to the library. A grace
+   * period that starts waiting right after we check is covered by its own
+   * timeout, just like with the library's version. */
+  if (__builtin_expect (!lp->ready, 0) ||
+      (!(value >> 1) &&
+       (__atomic_load_n (lp->gp_waiting, __ATOMIC_RELAXED) ||
+        *lp->tables[value & 1].flush)))
+    sref_read_exit ();
+  else
+    __atomic_store_n (&lp->counter, value, __ATOMIC_RELEASE);
+}
+
+/* Add DELTA for REFPTR if it can be done without any further processing.
+ * Returns 0 if the library has to take care of it instead. */
+static inline int
+sref_add_inline (void *refptr, intptr_t delta)
+{
+  SrefLocal *lp = &SREF_LOCAL;
+
+  /* Outside a critical section, a grace period could be applying the same
+   * table, so the library has to mark us as active first. */
+  if (__builtin_expect (!lp->ready || !(lp->counter >> 1) ||
+                        lp->n_ops + 1 >= lp->max_ops, 0))
+    return (0);
+
+  uintptr_t phase = __atomic_load_n (lp->gp_counter, __ATOMIC_RELAXED) & 1;
+  __typeof__ (lp->tables[0]) *tp = &lp->tables[phase];
+  uintptr_t idx = ((uintptr_t)refptr >> 3) & tp->mask;
+
+  if (*tp->flush > 1)
+    return (0);
+  else if (tp->keys[idx] == refptr)
+    tp->vals[idx] += delta;
+  else if (!tp->keys[idx] && *tp->n_used + 1 < tp->limit)
+    {
+      tp->keys[idx] = refptr;
+      tp->vals[idx] = delta;
+      ++*tp->n_used;
+    }
+  else
+    return (0);
+
+  ++lp->n_ops;
+  return (1);
+}
+
+static inline void*
+sref_acquire_inline (void *refptr)
+{
+  if (!sref_add_inline (refptr, 1))
+    sref_acquire (refptr);
+
+  return (refptr);
+}
+
+static inline void
+sref_release_inline (void *refptr)
+{
+  if (!sref_add_inline (refptr, -1))
+    sref_release (refptr);
+}
+
+static inline void
+sref_publish_inline (void *slot, void *ptr)
+{
+  __atomic_store_n ((void **)slot, ptr, __ATOMIC_RELEASE);
+}
+
+static inline void*
+sref_deref_inline (const void *slot)
+{
+  return (__atomic_load_n ((void *const *)slot, __ATOMIC_CONSUME));
+}
+
+#    define sref_read_enter()   sref_read_enter_inline ()
+#    define sref_read_exit()    sref_read_exit_inline ()
+#    define sref_acquire(ptr)   sref_acquire_inline (ptr)
+#    define sref_release(ptr)   sref_release_inline (ptr)
+#    define sref_publish(slot, ptr)   sref_publish_inline ((slot), (ptr))
+#    define sref_deref(slot)    sref_deref_inline (slot)
+
+#  endif
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,306 @@
+/* C++ interface for the sref API.
+
+   This file is part of libsref.
+
+   libsref is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef SREF_HPP_
+#define SREF_HPP_   1
+
+#include "sref.h"
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace sref
+{
+
+/* The types managed here must either derive from Sref, or be standard
+ * layout types that embed one as their first member, so that a pointer to
+ * them is a pointer to the Sref. */
+namespace detail
+{
+
+template <typename T>
+inline Sref*
+base_of (T *ptr, std::true_type) noexcept
+{
+  return (static_cast<Sref *> (ptr));
+}
+
+template <typename T>
+inline Sref*
+base_of (T *ptr, std::false_type) noexcept
+{
+  static_assert (std::is_standard_layout<T>::value,
+                 "T must derive from Sref, or be a standard layout type "
+                 "that starts with one");
+  return (reinterpret_cast<Sref *> (ptr));
+}
+
+template <typename T>
+inline T*
+from_base (Sref *ptr, std::true_type) noexcept
+{
+  return (static_cast<T *> (ptr));
+}
+
+template <typename T>
+inline T*
+from_base (Sref *ptr, std::false_type) noexcept
+{
+  return (reinterpret_cast<T *> (ptr));
+}
+
+}   // namespace detail
+
+template <typename T>
+inline Sref*
+base_of (T *ptr) noexcept
+{
+  return (detail::base_of (ptr, std::is_base_of<Sref, T> ()));
+}
+
+/* The reverse of 'base_of'. */
+template <typename T>
+inline T*
+from_base (Sref *ptr) noexcept
+{
+  return (detail::from_base<T> (ptr, std::is_base_of<Sref, T> ()));
+}
+
+/* Tag to take over a reference that the caller already owns. */
+struct adopt_t
+{
+  explicit adopt_t () = default;
+};
+
+static constexpr adopt_t adopt {};
+
+/* A read-side critical section, for the lifetime of the guard. */
+class read_guard
+{
+public:
+  read_guard () noexcept
+    {
+      sref_read_enter ();
+    }
+
+  ~read_guard ()
+    {
+      sref_read_exit ();
+    }
+
+  read_guard (const read_guard&) = delete;
+  read_guard& operator= (const read_guard&) = delete;
+};
+
+template <typename T> class ptr;
+
+/* A pointer that doesn't own a reference. It's only valid as long as the
+ * read guard that was active when it was loaded, and is meant for objects
+ * that are only looked at within it. Use 'acquire' to keep one beyond. */
+template <typename T>
+class borrowed
+{
+public:
+  borrowed () noexcept : m_ptr (nullptr)
+    {
+    }
+
+  explicit borrowed (T *ptr) noexcept : m_ptr (ptr)
+    {
+    }
+
+  T* get () const noexcept
+    {
+      return (this->m_ptr);
+    }
+
+  T& operator* () const noexcept
+    {
+      return (*this->m_ptr);
+    }
+
+  T* operator-> () const noexcept
+    {
+      return (this->m_ptr);
+    }
+
+  explicit operator bool () const noexcept
+    {
+      return (this->m_ptr != nullptr);
+    }
+
+  /* Take a reference of our own. */
+  ptr<T> acquire () const
+    {
+      return (ptr<T> (this->m_ptr));
+    }
+
+private:
+  T *m_ptr;
+};
+
+/* An owning pointer. Copies acquire a new reference, and destruction
+ * releases it, while moves hand over the one they have without adding
+ * anything to the tables of deltas. */
+template <typename T>
+class ptr
+{
+public:
+  ptr () noexcept : m_ptr (nullptr)
+    {
+    }
+
+  ptr (std::nullptr_t) noexcept : m_ptr (nullptr)
+    {
+    }
+
+  /* Acquire a new reference to PTR. */
+  explicit ptr (T *ptr) : m_ptr (ptr)
+    {
+      if (ptr)
+        sref_acquire (base_of (ptr));
+    }
+
+  /* Own the reference to PTR that the caller had, such as the one that
+   * 'sref_init' leaves. */
+  ptr (T *ptr, adopt_t) noexcept : m_ptr (ptr)
+    {
+    }
+
+  ptr (const ptr& right) : ptr (right.m_ptr)
+    {
+    }
+
+  ptr (ptr&& right) noexcept : m_ptr (right.m_ptr)
+    {
+      right.m_ptr = nullptr;
+    }
+
+  ~ptr ()
+    {
+      if (this->m_ptr)
+        sref_release (base_of (this->m_ptr));
+    }
+
+  ptr& operator= (const ptr& right)
+    {
+      ptr (right).swap (*this);
+      return (*this);
+    }
+
+  ptr& operator= (ptr&& right) noexcept
+    {
+      ptr (std::move (right)).swap (*this);
+      return (*this);
+    }
+
+  ptr& operator= (std::nullptr_t) noexcept
+    {
+      this->reset ();
+      return (*this);
+    }
+
+  void swap (ptr& right) noexcept
+    {
+      std::swap (this->m_ptr, right.m_ptr);
+    }
+
+  void reset () noexcept
+    {
+      ptr ().swap (*this);
+    }
+
+  /* Give up ownership of the reference, without releasing it. */
+  T* detach () noexcept
+    {
+      T *ret = this->m_ptr;
+      this->m_ptr = nullptr;
+      return (ret);
+    }
+
+  T* get () const noexcept
+    {
+      return (this->m_ptr);
+    }
+
+  T& operator* () const noexcept
+    {
+      return (*this->m_ptr);
+    }
+
+  T* operator-> () const noexcept
+    {
+      return (this->m_ptr);
+    }
+
+  explicit operator bool () const noexcept
+    {
+      return (this->m_ptr != nullptr);
+    }
+
+  /* Look at the object without a reference of our own. */
+  borrowed<T> borrow () const noexcept
+    {
+      return (borrowed<T> (this->m_ptr));
+    }
+
+private:
+  T *m_ptr;
+};
+
+template <typename T, typename U>
+inline bool
+operator== (const ptr<T>& left, const ptr<U>& right) noexcept
+{
+  return (left.get () == right.get ());
+}
+
+template <typename T, typename U>
+inline bool
+operator!= (const ptr<T>& left, const ptr<U>& right) noexcept
+{
+  return (left.get () != right.get ());
+}
+
+template <typename T>
+inline void
+swap (ptr<T>& left, ptr<T>& right) noexcept
+{
+  left.swap (right);
+}
+
+template <typename T>
+inline void
+fini_delete (void *ptr)
+{
+  delete from_base<T> (static_cast<Sref *> (ptr));
+}
+
+/* Allocate a T with operator new, and return the only reference to it.
+ * It's deleted once the last reference is released. */
+template <typename T, typename ...Args>
+inline ptr<T>
+make (Args&& ...args)
+{
+  T *ret = new T (std::forward<Args> (args)...);
+  sref_init (base_of (ret), fini_delete<T>);
+  return (ptr<T> (ret, adopt));
+}
+
+}   // namespace sref
+
+#endif
@@ -0,0 +1,264 @@
+/* Tests for the containers.
+
+   This file is part of libsref.
+
+   libsref is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#include "../container.h"
+
+typedef struct
+{
+  SrefMapEntry entry;
+  unsigned int key;
+} MapElem;
+
+typedef struct
+{
+  SrefListEntry entry;
+  unsigned int value;
+} ListElem;
+
+static int ctr_live;
+
+static void
+ctr_elem_fini (void *ptr)
+{
+  free (ptr);
+  atomic_inc (&ctr_live, -1);
+}
+
+static MapElem*
+ctr_map_elem (unsigned int key)
+{
+  MapElem *ret = (MapElem *)xmalloc (sizeof (*ret));
+  sref_init (ret, ctr_elem_fini);
+  ret->key = key;
+  atomic_inc (&ctr_live, 1);
+  return (ret);
+}
+
+static ListElem*
+ctr_list_elem (unsigned int value)
+{
+  ListElem *ret = (ListElem *)xmalloc (sizeof (*ret));
+  sref_init (ret, ctr_elem_fini);
+  ret->value = value;
+  atomic_inc (&ctr_live, 1);
+  return (ret);
+}
+
+static int
+ctr_key_equal (const void *entry, const void *key)
+{
+  return (((const MapElem *)entry)->key == *(const unsigned int *)key);
+}
+
+/* A poor hash on purpose, so that chains get long. */
+static uintptr_t
+ctr_hash (unsigned int key)
+{
+  return (key * 7);
+}
+
+static MapElem*
+ctr_lookup (SrefMap *map, unsigned int key)
+{
+  return ((MapElem *)sref_map_lookup (map, ctr_hash (key), &key));
+}
+
+static int
+ctr_insert (SrefMap *map, unsigned int key)
+{
+  MapElem *ep = ctr_map_elem (key);
+  int ret = sref_map_insert (map, ep, ctr_hash (key), &key);
+
+  if (ret)
+    { /* Not ours to keep, but nobody else has seen it either. */
+      sref_fini (ep);
+    }
+
+  return (ret);
+}
+
+static int
+ctr_remove (SrefMap *map, unsigned int key)
+{
+  return (sref_map_remove (map, ctr_hash (key), &key));
+}
+
+/* Enough elements for the map to grow several times. */
+#define MAP_NKEYS   1000
+
+static void
+test_ctr_map (void)
+{
+  SrefMap *map = sref_map_new (ctr_key_equal);
+  ASSERT (map);
+
+  for (unsigned int i = 0; i < MAP_NKEYS; ++i)
+    ASSERT (ctr_insert (map, i) == 0);
+
+  ASSERT (ctr_insert (map, 0) == 1);
+  ASSERT (sref_map_size (map) == MAP_NKEYS);
+
+  sref_read_enter ();
+  for (unsigned int i = 0; i < MAP_NKEYS; ++i)
+    {
+      MapElem *ep = ctr_lookup (map, i);
+      ASSERT (ep && ep->key == i);
+    }
+
+  ASSERT (!ctr_lookup (map, MAP_NKEYS));
+
+  /* Elements removed within a critical section stay usable in it. */
+  MapElem *ep = ctr_lookup (map, 1);
+  ASSERT (ctr_remove (map, 1) == 0);
+  ASSERT (ctr_remove (map, 1) < 0);
+  sref_flush ();
+  ASSERT (ep->key == 1 && !ctr_lookup (map, 1));
+  sref_read_exit ();
+
+  /* Shrink the map down to a few elements. */
+  for (unsigned int i = 2; i < MAP_NKEYS; ++i)
+    ASSERT (ctr_remove (map, i) == 0);
+
+  sref_read_enter ();
+  ASSERT (ctr_lookup (map, 0) && !ctr_lookup (map, 2));
+  sref_read_exit ();
+
+  ASSERT (sref_map_size (map) == 1);
+  sref_flush ();
+  ASSERT (ctr_live == 1);
+
+  sref_map_free (map);
+  sref_flush ();
+  ASSERT (ctr_live == 0);
+}
+
+#define MAP_NREADERS   3
+#define MAP_NLOOPS     200
+
+static uintptr_t ctr_stop;
+
+/* Every even key stays in the map the whole time. */
+static void*
+ctr_reader (void *arg)
+{
+  SrefMap *map = (SrefMap *)arg;
+  unsigned int n = 0;
+
+  while (!xatomic_load_acq (&ctr_stop))
+    {
+      sref_read_enter ();
+      for (unsigned int i = 0; i < MAP_NKEYS; i += 2)
+        {
+          MapElem *ep = ctr_lookup (map, i);
+          ASSERT (ep && ep->key == i);
+        }
+
+      sref_read_exit ();
+      ++n;
+    }
+
+  return ((void *)(uintptr_t)n);
+}
+
+static void
+test_ctr_map_mt (void)
+{
+  SrefMap *map = sref_map_new (ctr_key_equal);
+  pthread_t thrs[MAP_NREADERS];
+
+  for (unsigned int i = 0; i < MAP_NKEYS; i += 2)
+    ASSERT (ctr_insert (map, i) == 0);
+
+  ctr_stop = 0;
+  for (int i = 0; i < MAP_NREADERS; ++i)
+    ASSERT (pthread_create (&thrs[i], NULL, ctr_reader, map) == 0);
+
+  /* Add and remove the odd keys, making the map grow and shrink. */
+  for (int loop = 0; loop < MAP_NLOOPS; ++loop)
+    {
+      for (unsigned int i = 1; i < MAP_NKEYS; i += 2)
+        ASSERT (ctr_insert (map, i) == 0);
+
+      for (unsigned int i = 1; i < MAP_NKEYS; i += 2)
+        ASSERT (ctr_remove (map, i) == 0);
+    }
+
+  xatomic_store_rel (&ctr_stop, 1);
+  for (int i = 0; i < MAP_NREADERS; ++i)
+    pthread_join (thrs[i], NULL);
+
+  sref_map_free (map);
+  sref_flush ();
+  ASSERT (ctr_live == 0);
+}
+
+static void
+test_ctr_list (void)
+{
+  SrefList *list = sref_list_new ();
+  ListElem *elems[4];
+
+  ASSERT (list);
+  for (unsigned int i = 0; i < 4; ++i)
+    sref_list_push (list, elems[i] = ctr_list_elem (i));
+
+  sref_read_enter ();
+  unsigned int expected = 4;
+  for (ListElem *ep = (ListElem *)sref_list_first (list); ep;
+      ep = (ListElem *)sref_list_next (ep))
+    ASSERT (ep->value == --expected);
+
+  ASSERT (expected == 0);
+
+  /* Removing the element we are on leaves the iteration intact. */
+  ListElem *ep = (ListElem *)sref_list_next (sref_list_first (list));
+  ASSERT (ep == elems[2]);
+  ASSERT (sref_list_remove (list, elems[2]) == 0);
+  ASSERT (sref_list_remove (list, elems[2]) < 0);
+  ASSERT (sref_list_next (ep) == elems[1]);
+  ASSERT (sref_list_next (elems[3]) == elems[1]);
+  sref_read_exit ();
+
+  sref_flush ();
+  ASSERT (ctr_live == 3);
+
+  ep = (ListElem *)sref_list_pop (list);
+  ASSERT (ep == elems[3]);
+  sref_release (ep);
+
+  sref_list_free (list);
+  sref_flush ();
+  ASSERT (ctr_live == 0);
+}
+
+static const TestFn ctr_test_fns[] =
+{
+  {
+    "hash map",
+    test_ctr_map
+  },
+  {
+    "concurrent hash map",
+    test_ctr_map_mt
+  },
+  {
+    "linked list",
+    test_ctr_list
+  }
+};
+
+TEST_MODULE (CONTAINER, ctr_test_fns);
@@ -0,0 +1,97 @@
+/* Tests for the C++ interface.
+
+   This file is part of libsref.
+
+   libsref is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#include "sref.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+#define ASSERT(cond)   \
+  do   \
+    {   \
+      if (!(cond))   \
+        {   \
+          std::fprintf (stderr, "%s:%d: assertion failed: %s\n",   \
+                        __FILE__, __LINE__, #cond);   \
+          std::abort ();   \
+        }   \
+    }   \
+  while (0)
+
+static int n_live;
+
+/* Embeds the Sref as its first member. */
+struct Member
+{
+  Sref base;
+  int value;
+
+  explicit Member (int val) : base (), value (val)
+    {
+      ++n_live;
+    }
+
+  ~Member ()
+    {
+      --n_live;
+    }
+};
+
+/* Derives from Sref, which makes it a non standard layout type. */
+struct Derived : Sref
+{
+  int value;
+
+  explicit Derived (int val) : Sref (), value (val)
+    {
+      ++n_live;
+    }
+
+  ~Derived ()
+    {
+      --n_live;
+    }
+};
+
+template <typename T>
+static void
+test_type ()
+{
+  {
+    sref::ptr<T> p = sref::make<T> (42);
+    ASSERT (n_live == 1);
+    ASSERT (sref::from_base<T> (sref::base_of (p.get ())) == p.get ());
+
+    sref::ptr<T> q (p);
+    sref::read_guard guard;
+    sref::borrowed<T> b = q.borrow ();
+    ASSERT (b->value == 42);
+  }
+
+  sref_flush ();
+  ASSERT (n_live == 0);
+}
+
+int main ()
+{
+  if (sref_lib_init () < 0)
+    std::abort ();
+
+  test_type<Member> ();
+  test_type<Derived> ();
+  std::puts ("Testing C++ interface ... OK");
+  return (0);
+}
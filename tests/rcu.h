@@ -62,6 +62,10 @@ test_rcu_single_thread (void)
     abort ();
 
   pthread_join (thr, 0);
+
+  /* The exiting thread left its deltas for the next grace period. */
+  ASSERT (rcu_obj_counter == 1);
+  sref_flush ();
   ASSERT (rcu_obj_counter == 0);
 }
 
@@ -110,6 +114,663 @@ test_rcu_limits (void)
 
   sref_release (&single);
   ASSERT (rcu_obj_counter == 0);
+
+  /* Entering a critical section between every release mustn't keep the
+   * table from being flushed once it's at its limit. */
+  for (int i = 0; i < SREF_NDELTAS * 2; ++i)
+    {
+      sref_release (rcu_obj_make (i));
+      sref_read_enter ();
+      sref_read_exit ();
+    }
+
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 0);
+}
+
+#define GROW_NOBJS   (SREF_NDELTAS * 10)
+
+static void
+test_rcu_grow (void)
+{
+  Object *objs = (Object *)xmalloc (GROW_NOBJS * sizeof (*objs));
+  for (int i = 0; i < GROW_NOBJS; ++i)
+    sref_init (&objs[i], fini_basic);
+
+  sref_flush ();
+  rcu_obj_counter = GROW_NOBJS;
+  sref_read_enter ();
+
+  for (int i = 0; i < GROW_NOBJS; ++i)
+    sref_acquire (&objs[i]);
+
+  for (int i = 0; i < GROW_NOBJS; ++i)
+    {
+      sref_release (&objs[i]);
+      sref_release (&objs[i]);
+    }
+
+  /* Falling back to the review list modifies the reference counts in place,
+   * so if the tables grew as expected, every object must be left untouched. */
+  for (int i = 0; i < GROW_NOBJS; ++i)
+    ASSERT (objs[i].base.refcnt == 1 && !objs[i].base.next);
+
+  ASSERT (rcu_obj_counter == GROW_NOBJS);
+  sref_read_exit ();
+  ASSERT (rcu_obj_counter == 0);
+  free (objs);
+}
+
+static void
+test_rcu_batch (void)
+{
+  Object *objs = (Object *)xmalloc (GROW_NOBJS * sizeof (*objs));
+  void **ptrs = (void **)xmalloc (GROW_NOBJS * sizeof (*ptrs));
+
+  for (int i = 0; i < GROW_NOBJS; ++i)
+    {
+      sref_init (&objs[i], fini_basic);
+      ptrs[i] = &objs[i];
+    }
+
+  sref_flush ();
+  rcu_obj_counter = GROW_NOBJS;
+
+  /* Batches inside a critical section must grow the tables. */
+  sref_read_enter ();
+  sref_acquire_n (ptrs, GROW_NOBJS);
+  sref_release_n (ptrs, GROW_NOBJS);
+
+  for (int i = 0; i < GROW_NOBJS; ++i)
+    ASSERT (objs[i].base.refcnt == 1 && !objs[i].base.next);
+
+  sref_read_exit ();
+  ASSERT (rcu_obj_counter == GROW_NOBJS);
+
+  /* Whereas outside of one, they must be split and flushed. */
+  sref_release_n (ptrs, GROW_NOBJS);
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 0);
+
+  free (ptrs);
+  free (objs);
+}
+
+#define STATS_NOBJS   16
+
+static void
+test_rcu_stats (void)
+{
+  SrefStats prev, cur;
+
+  sref_flush ();
+  if (sref_stats_local (&prev) < 0)
+    {
+      /* Compiled out - Both calls must say so. */
+      ASSERT (sref_stats_get (&cur) < 0);
+      return;
+    }
+
+  Object objs[STATS_NOBJS];
+  for (int i = 0; i < STATS_NOBJS; ++i)
+    sref_init (&objs[i], fini_basic);
+
+  /* Stay in a critical section so that every delta lands in one table. */
+  rcu_obj_counter = STATS_NOBJS;
+  sref_read_enter ();
+  for (int i = 0; i < STATS_NOBJS; ++i)
+    {
+      sref_acquire (&objs[i]);
+      sref_release (&objs[i]);
+      sref_release (&objs[i]);
+    }
+
+  sref_read_exit ();
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 0);
+  ASSERT (sref_stats_local (&cur) == 0);
+
+  uint64_t nprobes = 0;
+  for (int i = 0; i < SREF_STATS_NPROBES; ++i)
+    nprobes += cur.probes[i] - prev.probes[i];
+
+  ASSERT (cur.n_gps > prev.n_gps);
+  ASSERT (cur.n_flush_explicit == prev.n_flush_explicit + 1);
+  ASSERT (cur.n_fini - prev.n_fini == STATS_NOBJS);
+  /* Matching acquires and releases cancel out, leaving a single delta. */
+  ASSERT (cur.n_deltas - prev.n_deltas == STATS_NOBJS);
+  ASSERT (cur.n_review == prev.n_review);
+  ASSERT (nprobes == 3 * STATS_NOBJS);
+  ASSERT (cur.sync_ns >= cur.poll_ns);
+
+  /* The process-wide numbers include ours. */
+  ASSERT (sref_stats_get (&prev) == 0);
+  ASSERT (prev.n_gps >= cur.n_gps && prev.n_fini >= cur.n_fini);
+}
+
+/* Crossing the table threshold must hand the flush to the reclaimer. Stay
+ * well below the point where we would apply backpressure, though. */
+#define RECLAIMER_NOBJS   (SREF_NDELTAS * 4 / 5)
+
+static pthread_t reclaimer_caller;
+static int reclaimer_inline;
+
+static void
+fini_reclaimer (void *ptr)
+{
+  if (pthread_equal (pthread_self (), reclaimer_caller))
+    reclaimer_inline = 1;
+
+  fini_basic (ptr);
+}
+
+static void
+test_rcu_reclaimer (void)
+{
+  Object objs[RECLAIMER_NOBJS];
+  for (int i = 0; i < RECLAIMER_NOBJS; ++i)
+    sref_init (&objs[i], fini_reclaimer);
+
+  ASSERT (sref_lib_init_ex (SREF_LIB_RECLAIMER) == 0);
+  sref_flush ();
+  rcu_obj_counter = RECLAIMER_NOBJS;
+  reclaimer_caller = pthread_self ();
+
+  for (int i = 0; i < RECLAIMER_NOBJS; ++i)
+    sref_release (&objs[i]);
+
+  for (int i = 0; i < 1000; ++i)
+    {
+      if (xatomic_load_acq (&rcu_obj_counter) < RECLAIMER_NOBJS)
+        break;
+
+      xthread_sleep (1);
+    }
+
+  ASSERT (xatomic_load_acq (&rcu_obj_counter) < RECLAIMER_NOBJS);
+  ASSERT (!reclaimer_inline);
+  ASSERT (sref_lib_init_ex (0) == 0);
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 0);
+}
+
+static void
+test_rcu_latency (void)
+{
+  Object obj;
+  sref_init (&obj, fini_basic);
+  sref_flush ();
+
+  /* A single release never reaches the flush thresholds by itself. */
+  ASSERT (sref_set_max_latency (10) == 0);
+  rcu_obj_counter = 1;
+  sref_release (&obj);
+
+  for (int i = 0; i < 2000; ++i)
+    {
+      if (xatomic_load_acq (&rcu_obj_counter) == 0)
+        break;
+
+      xthread_sleep (1);
+    }
+
+  ASSERT (xatomic_load_acq (&rcu_obj_counter) == 0);
+  ASSERT (sref_set_max_latency (0) == 0);
+}
+
+#define FINI_NOBJS   256
+
+static int fini_offthread;
+
+static void
+fini_pool (void *ptr)
+{
+  if (!pthread_equal (pthread_self (), reclaimer_caller))
+    atomic_inc (&fini_offthread, 1);
+
+  fini_basic (ptr);
+}
+
+/* Finalizers run without the registry locks, so they may flush. */
+static void
+fini_flush (void *ptr)
+{
+  sref_flush ();
+  fini_basic (ptr);
+}
+
+static void
+test_rcu_finalizers (void)
+{
+  Object objs[FINI_NOBJS];
+  for (int i = 0; i < FINI_NOBJS; ++i)
+    sref_init (&objs[i], fini_pool);
+
+  ASSERT (sref_lib_config (SREF_CONFIG_FINALIZERS, 0) < 0);
+  ASSERT (sref_lib_config (SREF_CONFIG_FINALIZERS, 2) == 0);
+  ASSERT (sref_lib_init_ex (SREF_LIB_FINALIZERS) == 0);
+  sref_flush ();
+
+  rcu_obj_counter = FINI_NOBJS;
+  fini_offthread = 0;
+  reclaimer_caller = pthread_self ();
+
+  for (int i = 0; i < FINI_NOBJS; ++i)
+    sref_release (&objs[i]);
+
+  sref_flush ();
+
+  /* Stopping the pool waits for the finalizers it was handed. */
+  ASSERT (sref_lib_init_ex (0) == 0);
+  ASSERT (rcu_obj_counter == 0);
+  ASSERT (fini_offthread == FINI_NOBJS);
+  ASSERT (sref_lib_config (SREF_CONFIG_FINALIZERS, 1) == 0);
+
+  sref_init (&objs[0], fini_flush);
+  rcu_obj_counter = 1;
+  sref_release (&objs[0]);
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 0);
+}
+
+/* Enough deltas for the helper threads to be woken up. */
+#define PARALLEL_NOBJS   (SREF_NDELTAS * 16)
+
+static int parallel_offthread;
+
+static void
+fini_parallel (void *ptr)
+{
+  if (!pthread_equal (pthread_self (), reclaimer_caller))
+    atomic_inc (&parallel_offthread, 1);
+
+  atomic_inc (&rcu_obj_counter, -1);
+}
+
+static void
+rcu_parallel_run (unsigned int flags)
+{
+  Object *objs = (Object *)xmalloc (PARALLEL_NOBJS * sizeof (*objs));
+  for (int i = 0; i < PARALLEL_NOBJS; ++i)
+    sref_init (&objs[i], fini_parallel);
+
+  parallel_offthread = 0;
+  ASSERT (sref_lib_init_ex (flags) == 0);
+  sref_flush ();
+  rcu_obj_counter = PARALLEL_NOBJS;
+  reclaimer_caller = pthread_self ();
+
+  /* Every even object gets an extra reference and must survive. */
+  sref_read_enter ();
+  for (int i = 0; i < PARALLEL_NOBJS; ++i)
+    {
+      sref_acquire (&objs[i]);
+      if (i % 2 == 0)
+        sref_acquire (&objs[i]);
+    }
+
+  for (int i = 0; i < PARALLEL_NOBJS; ++i)
+    {
+      sref_release (&objs[i]);
+      sref_release (&objs[i]);
+    }
+
+  sref_read_exit ();
+  ASSERT (rcu_obj_counter == PARALLEL_NOBJS / 2);
+
+  /* Helpers only collect dead objects; the finalizers run afterwards. */
+  ASSERT (parallel_offthread == 0);
+
+  for (int i = 0; i < PARALLEL_NOBJS; i += 2)
+    {
+      ASSERT (objs[i].base.refcnt == 1);
+      sref_release (&objs[i]);
+    }
+
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 0);
+  ASSERT (sref_lib_init_ex (0) == 0);
+  free (objs);
+}
+
+static void
+test_rcu_parallel (void)
+{
+  rcu_parallel_run (SREF_LIB_PARALLEL);
+}
+
+/* Run with SREF_NUMA_NODES set to test a simulated topology. */
+static void
+test_rcu_numa (void)
+{
+  rcu_parallel_run (SREF_LIB_NUMA);
+}
+
+/* A forked child must not wait on helpers that only exist in its parent. */
+static void
+test_rcu_fork (void)
+{
+  SrefAtFork cbs = sref_atfork ();
+  ASSERT (sref_lib_init_ex (SREF_LIB_PARALLEL) == 0);
+
+  cbs.prepare ();
+  pid_t pid = fork ();
+  ASSERT (pid >= 0);
+
+  if (pid == 0)
+    {
+      cbs.child ();
+      alarm (10);
+
+      Object *objs = (Object *)xmalloc (PARALLEL_NOBJS * sizeof (*objs));
+      for (int i = 0; i < PARALLEL_NOBJS; ++i)
+        sref_init (&objs[i], fini_basic);
+
+      rcu_obj_counter = PARALLEL_NOBJS;
+      sref_read_enter ();
+      for (int i = 0; i < PARALLEL_NOBJS; ++i)
+        sref_release (&objs[i]);
+      sref_read_exit ();
+
+      sref_flush ();
+      _exit (rcu_obj_counter == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+  cbs.parent ();
+
+  int status;
+  ASSERT (waitpid (pid, &status, 0) == pid);
+  ASSERT (WIFEXITED (status) && WEXITSTATUS (status) == EXIT_SUCCESS);
+  ASSERT (sref_lib_init_ex (0) == 0);
+}
+
+#define CONFIG_NOBJS   9
+
+static void
+test_rcu_config (void)
+{
+  Object objs[CONFIG_NOBJS];
+
+  ASSERT (sref_lib_config (SREF_CONFIG_CAPACITY, 24) < 0);
+  ASSERT (sref_lib_config (SREF_CONFIG_LOAD, 100) < 0);
+  ASSERT (sref_lib_config (SREF_CONFIG_MAX_OPS, 0) < 0);
+  ASSERT (sref_thread_config (SREF_CONFIG_HELPERS, 1) < 0);
+  ASSERT (sref_thread_config (SREF_CONFIG_HELPERS, 0) < 0);
+  ASSERT (sref_thread_config (-1, 0) < 0);
+
+  /* With 16 slots at 50%, the table fills up after 8 objects. */
+  ASSERT (sref_thread_config (SREF_CONFIG_CAPACITY, 16) == 0);
+  ASSERT (sref_thread_config (SREF_CONFIG_LOAD, 50) == 0);
+  sref_flush ();
+
+  for (int i = 0; i < CONFIG_NOBJS; ++i)
+    sref_init (&objs[i], fini_basic);
+
+  rcu_obj_counter = CONFIG_NOBJS;
+  for (int i = 0; i < CONFIG_NOBJS; ++i)
+    sref_release (&objs[i]);
+
+  ASSERT (rcu_obj_counter == 0);
+
+  /* Tables can't be resized inside a critical section. */
+  sref_init (&objs[0], NULL);
+  sref_read_enter ();
+  sref_acquire (&objs[0]);
+  ASSERT (sref_thread_config (SREF_CONFIG_CAPACITY, 64) < 0);
+  sref_release (&objs[0]);
+  sref_read_exit ();
+
+  /* The smallest tables at the highest load must still leave room for the
+   * deltas added until a pending flush is run. */
+  for (unsigned int cap = 4; cap <= 8; cap *= 2)
+    {
+      ASSERT (sref_thread_config (SREF_CONFIG_CAPACITY, cap) == 0);
+      ASSERT (sref_thread_config (SREF_CONFIG_LOAD, 90) == 0);
+
+      for (int i = 0; i < CONFIG_NOBJS; ++i)
+        sref_init (&objs[i], fini_basic);
+
+      rcu_obj_counter = CONFIG_NOBJS;
+      for (int i = 0; i < CONFIG_NOBJS; ++i)
+        sref_acquire (&objs[i]);
+
+      for (int i = 0; i < CONFIG_NOBJS; ++i)
+        {
+          sref_release (&objs[i]);
+          sref_release (&objs[i]);
+        }
+
+      sref_flush ();
+      ASSERT (rcu_obj_counter == 0);
+    }
+
+  ASSERT (sref_thread_config (SREF_CONFIG_CAPACITY, 0) == 0);
+  ASSERT (sref_thread_config (SREF_CONFIG_LOAD, 0) == 0);
+  sref_flush ();
+}
+
+static void
+test_rcu_adapt (void)
+{
+  ASSERT (sref_thread_config (SREF_CONFIG_ADAPT_MAX, 64) < 0);
+
+  /* Equal bounds leave no room to adapt. */
+  ASSERT (sref_lib_config (SREF_CONFIG_ADAPT_MIN, 32) == 0);
+  ASSERT (sref_lib_config (SREF_CONFIG_ADAPT_MAX, 32) == 0);
+  sref_flush ();
+  ASSERT (SREF_LOCAL.max_ops == 32);
+
+  ASSERT (sref_lib_config (SREF_CONFIG_ADAPT_MIN, 4) == 0);
+  ASSERT (sref_lib_config (SREF_CONFIG_ADAPT_MAX, 64) == 0);
+
+  Object obj;
+  sref_init (&obj, NULL);
+  for (int i = 0; i < 256; ++i)
+    {
+      sref_acquire (&obj);
+      sref_release (&obj);
+      if (i % 16 == 0)
+        {
+          sref_flush ();
+          ASSERT (SREF_LOCAL.max_ops >= 4 &&
+                  SREF_LOCAL.max_ops <= 64);
+        }
+    }
+
+  /* An explicit trigger is left alone until it's reset. */
+  ASSERT (sref_thread_config (SREF_CONFIG_MAX_OPS, 500) == 0);
+  sref_flush ();
+  ASSERT (SREF_LOCAL.max_ops == 500);
+
+  ASSERT (sref_thread_config (SREF_CONFIG_MAX_OPS, 0) == 0);
+  sref_flush ();
+  ASSERT (SREF_LOCAL.max_ops <= 64);
+
+  ASSERT (sref_lib_config (SREF_CONFIG_ADAPT_MAX, 0) == 0);
+  ASSERT (sref_lib_config (SREF_CONFIG_ADAPT_MIN, 0) == 0);
+  ASSERT (sref_thread_config (SREF_CONFIG_MAX_OPS, 0) == 0);
+}
+
+/* Enough threads for the deltas to be merged. */
+#define MERGE_NTHR    12
+#define MERGE_NOBJS   64
+
+static Object merge_objs[MERGE_NOBJS];
+
+static void*
+merge_thread (void *arg)
+{
+  (void)arg;
+  sref_read_enter ();
+  for (int i = 0; i < MERGE_NOBJS; ++i)
+    {
+      sref_acquire (&merge_objs[i]);
+      sref_acquire (&merge_objs[i]);
+      sref_release (&merge_objs[i]);
+    }
+
+  sref_read_exit ();
+  return (0);
+}
+
+static void
+test_rcu_merge (void)
+{
+  pthread_t thrs[MERGE_NTHR];
+
+  for (int i = 0; i < MERGE_NOBJS; ++i)
+    sref_init (&merge_objs[i], fini_basic);
+
+  sref_flush ();
+  rcu_obj_counter = MERGE_NOBJS;
+
+  for (int i = 0; i < MERGE_NTHR; ++i)
+    ASSERT (pthread_create (&thrs[i], NULL, merge_thread, NULL) == 0);
+
+  for (int i = 0; i < MERGE_NTHR; ++i)
+    pthread_join (thrs[i], NULL);
+
+  sref_flush ();
+  for (int i = 0; i < MERGE_NOBJS; ++i)
+    {
+      ASSERT (merge_objs[i].base.refcnt == MERGE_NTHR + 1);
+      for (int j = 0; j <= MERGE_NTHR; ++j)
+        sref_release (&merge_objs[i]);
+    }
+
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 0);
+}
+
+#define REGISTER_NTHR   64
+
+static int register_stop;
+
+static void*
+register_flusher (void *arg)
+{
+  (void)arg;
+  while (!xatomic_load_acq (&register_stop))
+    sref_flush ();
+
+  return (0);
+}
+
+static void
+test_rcu_register (void)
+{
+  pthread_t flusher, thrs[REGISTER_NTHR];
+
+  sref_flush ();
+  rcu_obj_counter = 0;
+  register_stop = 0;
+  ASSERT (pthread_create (&flusher, NULL, register_flusher, NULL) == 0);
+
+  /* Threads register themselves while grace periods are running. */
+  for (int i = 0; i < REGISTER_NTHR; ++i)
+    ASSERT (pthread_create (&thrs[i], NULL, rcu_thread_fn, NULL) == 0);
+
+  for (int i = 0; i < REGISTER_NTHR; ++i)
+    pthread_join (thrs[i], NULL);
+
+  xatomic_store_rel (&register_stop, 1);
+  pthread_join (flusher, NULL);
+
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 0);
+}
+
+#define PIN_NTHR    4
+#define PIN_LOOPS   20000
+
+static Object *pin_obj;
+
+static void*
+pin_thread (void *arg)
+{
+  (void)arg;
+
+  /* Outside a critical section, every operation pins the thread while it
+   * adds to its table, racing against the flusher's phase flips. */
+  for (int i = 0; i < PIN_LOOPS; ++i)
+    {
+      sref_acquire (pin_obj);
+      ASSERT (pin_obj->value == 1);
+      sref_release (pin_obj);
+    }
+
+  return (0);
+}
+
+static void
+test_rcu_pin (void)
+{
+  pthread_t flusher, thrs[PIN_NTHR];
+
+  sref_flush ();
+  rcu_obj_counter = 0;
+  register_stop = 0;
+  pin_obj = rcu_obj_make (1);
+  ASSERT (pthread_create (&flusher, NULL, register_flusher, NULL) == 0);
+
+  for (int i = 0; i < PIN_NTHR; ++i)
+    ASSERT (pthread_create (&thrs[i], NULL, pin_thread, NULL) == 0);
+
+  for (int i = 0; i < PIN_NTHR; ++i)
+    pthread_join (thrs[i], NULL);
+
+  xatomic_store_rel (&register_stop, 1);
+  pthread_join (flusher, NULL);
+
+  /* A lost or repeated delta would have finalized it early, or never. */
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 1);
+  sref_release (pin_obj);
+  sref_flush ();
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 0);
+}
+
+static void
+call_basic (void *ptr)
+{
+  ++*(int *)ptr;
+}
+
+static void
+call_flush (void *ptr)
+{
+  /* This would hang if callbacks ran with the registry locks held. */
+  ASSERT (sref_flush () >= 0);
+  ++*(int *)ptr;
+}
+
+#define CALL_NCALLS   100
+
+static void
+test_rcu_call (void)
+{
+  int n_calls = 0;
+
+  sref_flush ();
+  sref_read_enter ();
+
+  for (int i = 0; i < CALL_NCALLS; ++i)
+    ASSERT (sref_call (&n_calls, call_basic) == 0);
+
+  ASSERT (sref_flush () < 0);
+  ASSERT (n_calls == 0);
+  sref_read_exit ();
+  ASSERT (n_calls == CALL_NCALLS);
+
+  ASSERT (sref_call (&n_calls, call_basic) == 0);
+  ASSERT (n_calls == CALL_NCALLS);
+  sref_flush ();
+  ASSERT (n_calls == CALL_NCALLS + 1);
+
+  ASSERT (sref_call (&n_calls, call_flush) == 0);
+  sref_flush ();
+  ASSERT (n_calls == CALL_NCALLS + 2);
 }
 
 static unsigned int
@@ -139,7 +800,7 @@ rcu_thread (void *arg)
   for (int i = 0; i < THREAD_LOOPS; ++i)
     {
       sref_read_enter ();
-      unsigned int value = global_obj->value;
+      unsigned int value = ((Object *)sref_deref (&global_obj))->value;
 
       if ((value % 4) == 0)
         {
@@ -147,10 +808,7 @@ rcu_thread (void *arg)
           xmutex_lock (&global_lock);
           if (global_obj->value == value)
             {
-              Object *prev = global_obj;
-              global_obj = p;
-              xatomic_mfence_full ();
-              sref_release (prev);
+              sref_swap (&global_obj, p);
               ++rcu_obj_counter;
             }
           else
@@ -167,6 +825,30 @@ rcu_thread (void *arg)
 
 #define NTHR   16
 
+static void
+test_rcu_publish (void)
+{
+  Object *slot = NULL;
+  Object *a = rcu_obj_make (1), *b = rcu_obj_make (2);
+
+  rcu_obj_counter = 2;
+  sref_publish (&slot, a);
+  ASSERT (sref_deref (&slot) == a);
+
+  /* The old pointers stay usable until we leave the critical section. */
+  sref_read_enter ();
+  ASSERT (sref_swap (&slot, b) == a);
+  ASSERT (sref_cas (&slot, a, NULL) < 0);
+  ASSERT (sref_cas (&slot, b, NULL) == 0);
+  ASSERT (!sref_deref (&slot));
+  sref_flush ();
+  ASSERT (rcu_obj_counter == 2 && a->value == 1 && b->value == 2);
+  sref_read_exit ();
+
+  ASSERT (rcu_obj_counter == 0);
+  ASSERT (!sref_swap (&slot, NULL));
+}
+
 static void
 test_rcu_mt (void)
 {
@@ -190,6 +872,8 @@ test_rcu_mt (void)
       seed += info[i].cnt;
     }
 
+  /* Apply the deltas that the threads left behind. */
+  sref_flush ();
   seed += rcu_obj_counter;
   ASSERT (seed == NTHR * THREAD_LOOPS);
 }
@@ -204,6 +888,70 @@ static const TestFn rcu_test_fns[] =
     "API limits",
     test_rcu_limits
   },
+  {
+    "deferred callbacks",
+    test_rcu_call
+  },
+  {
+    "table growth",
+    test_rcu_grow
+  },
+  {
+    "runtime configuration",
+    test_rcu_config
+  },
+  {
+    "adaptive flush trigger",
+    test_rcu_adapt
+  },
+  {
+    "batched API",
+    test_rcu_batch
+  },
+  {
+    "statistics",
+    test_rcu_stats
+  },
+  {
+    "background reclaimer",
+    test_rcu_reclaimer
+  },
+  {
+    "reclamation deadline",
+    test_rcu_latency
+  },
+  {
+    "finalizer pool",
+    test_rcu_finalizers
+  },
+  {
+    "parallel delta application",
+    test_rcu_parallel
+  },
+  {
+    "NUMA delta application",
+    test_rcu_numa
+  },
+  {
+    "fork with helper threads",
+    test_rcu_fork
+  },
+  {
+    "merged delta application",
+    test_rcu_merge
+  },
+  {
+    "concurrent registration",
+    test_rcu_register
+  },
+  {
+    "pinned operations across phase flips",
+    test_rcu_pin
+  },
+  {
+    "pointer publication",
+    test_rcu_publish
+  },
   {
     "multi threaded API",
     test_rcu_mt
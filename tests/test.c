@@ -17,6 +17,7 @@
 
 #include "utils.h"
 #include "rcu.h"
+#include "container.h"
 
 int main ()
 {
@@ -24,7 +25,7 @@ int main ()
     abort ();
 
   test_init ();
-  const TestModule *mods[] = { &RCU };
+  const TestModule *mods[] = { &RCU, &CONTAINER };
 
   for (size_t i = 0; i < ARRAY_SIZE (mods); ++i)
     {
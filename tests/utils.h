@@ -23,6 +23,7 @@
 #include <stddef.h>
 #include <time.h>
 #include <pthread.h>
+#include <sys/wait.h>
 #include "../sref.h"
 #include "../compat.h"
 